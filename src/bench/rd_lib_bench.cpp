@@ -0,0 +1,132 @@
+// NOTE: standalone microbenchmarks for rd_lib.h, doesn't need a GL context
+//       run with "make bench" to get the results at every optimization level
+
+#include "../rd_lib.h"
+
+#include <chrono>
+#include <vector>
+#include "stdlib.h"
+#include "string.h"
+
+#define BENCH_BATCH_SIZE 4096
+#define BENCH_REPETITIONS 256
+
+// NOTE: results are summed in here so the compiler can't throw the work away
+GLOBAL volatile f32 bench_sink;
+
+INTERNAL f32 RandomFloat(f32 min, f32 max)
+{
+    f32 result = min + (max - min) * ((f32)rand() / (f32)RAND_MAX);
+
+    return(result);
+}
+
+INTERNAL vec3 RandomVec3(f32 min, f32 max)
+{
+    vec3 result = Vec3(RandomFloat(min, max), RandomFloat(min, max), RandomFloat(min, max));
+
+    return(result);
+}
+
+INTERNAL mat4x4 RandomTRS(void)
+{
+    mat4x4 rotation = RotationX(RandomFloat(-PI32, PI32)) *
+                      RotationY(RandomFloat(-PI32, PI32)) *
+                      RotationZ(RandomFloat(-PI32, PI32));
+    mat4x4 result = Translation(RandomVec3(-100.0f, 100.0f)) * rotation * Scaling(RandomVec3(0.1f, 10.0f));
+
+    return(result);
+}
+
+INTERNAL f64 NanosecondsSince(std::chrono::high_resolution_clock::time_point start)
+{
+    std::chrono::duration<f64, std::nano> elapsed = std::chrono::high_resolution_clock::now() - start;
+    f64 result = elapsed.count();
+
+    return(result);
+}
+
+INTERNAL void PrintResult(const char *name, f64 nanoseconds, u64 op_count)
+{
+    printf("%-32s %10.2f ns/op\n", name, nanoseconds / (f64)op_count);
+}
+
+// NOTE: runs expression for every i in the batch BENCH_REPETITIONS times,
+//       expression must evaluate to a f32 that gets summed into bench_sink.
+//       j picks a second operand that is different from the first one
+#define Benchmark(name, expression) \
+{ \
+    f32 sum = 0.0f; \
+    auto start = std::chrono::high_resolution_clock::now(); \
+    for(u32 repetition = 0; repetition < BENCH_REPETITIONS; repetition++) \
+    { \
+        for(u32 i = 0; i < BENCH_BATCH_SIZE; i++) \
+        { \
+            u32 j = (i + 1) & (BENCH_BATCH_SIZE - 1); \
+            (void)j; \
+            sum += (expression); \
+        } \
+    } \
+    PrintResult(name, NanosecondsSince(start), (u64)BENCH_BATCH_SIZE * BENCH_REPETITIONS); \
+    bench_sink = sum; \
+}
+
+int main(void)
+{
+#if RD_SIMD_AVX
+    PrintString("simd path: avx");
+#elif RD_SIMD_SSE
+    PrintString("simd path: sse");
+#else
+    PrintString("simd path: scalar");
+#endif
+
+    srand(1);
+    std::vector<mat4x4> trs_list(BENCH_BATCH_SIZE);
+    std::vector<mat4x4> projection_mul_view_list(BENCH_BATCH_SIZE);
+    std::vector<vec3> a_list(BENCH_BATCH_SIZE);
+    std::vector<vec3> b_list(BENCH_BATCH_SIZE);
+    std::vector<vec4> v4_list(BENCH_BATCH_SIZE);
+    std::vector<f32> fov_list(BENCH_BATCH_SIZE);
+    for(u32 i = 0; i < BENCH_BATCH_SIZE; i++)
+    {
+        trs_list[i] = RandomTRS();
+        a_list[i] = RandomVec3(-100.0f, 100.0f);
+        b_list[i] = RandomVec3(-100.0f, 100.0f);
+        v4_list[i] = Vec4(RandomVec3(-100.0f, 100.0f), 1.0f);
+        fov_list[i] = RandomFloat(30.0f, 90.0f);
+
+        mat4x4 projection = Perspective(fov_list[i], 16.0f / 9.0f, 0.05f, RandomFloat(10.0f, 1000.0f));
+        mat4x4 view = LookAt(a_list[i], b_list[i], Vec3(0.0f, 1.0f, 0.0f));
+        projection_mul_view_list[i] = projection * view;
+    }
+
+    // NOTE: the simd multiply must give the exact same bits as the scalar one,
+    //       otherwise the timings below compare two different functions
+    for(u32 i = 0; i < BENCH_BATCH_SIZE; i++)
+    {
+        u32 j = (i + 1) & (BENCH_BATCH_SIZE - 1);
+        mat4x4 simd = trs_list[i] * trs_list[j];
+        mat4x4 scalar = MultiplyScalar(trs_list[i], trs_list[j]);
+        if(memcmp(&simd, &scalar, sizeof(mat4x4)) != 0)
+        {
+            printf("operator*(mat4x4, mat4x4) differs from MultiplyScalar for inputs %u and %u\n", i, j);
+            return(1);
+        }
+    }
+
+    Benchmark("operator*(mat4x4, mat4x4)", (trs_list[i] * trs_list[j]).e[1][2]);
+    Benchmark("MultiplyScalar(mat4x4, mat4x4)", MultiplyScalar(trs_list[i], trs_list[j]).e[1][2]);
+    Benchmark("operator*(mat4x4, vec4)", (trs_list[i] * v4_list[i]).y);
+    Benchmark("Transpose", Transpose(trs_list[i]).e[1][2]);
+    Benchmark("Inverse", Inverse(trs_list[i]).e[0][3]);
+    Benchmark("Mat3x3(Transpose(Inverse))", Mat3x3(Transpose(Inverse(trs_list[i]))).e[1][2]);
+    Benchmark("InverseTranspose3x3", InverseTranspose3x3(trs_list[i]).e[1][2]);
+    Benchmark("LookAt", LookAt(a_list[i], b_list[i], Vec3(0.0f, 1.0f, 0.0f)).e[0][3]);
+    Benchmark("Perspective", Perspective(fov_list[i], 16.0f / 9.0f, 0.05f, 100.0f).e[0][0]);
+    Benchmark("Normalize", Normalize(a_list[i]).x);
+    Benchmark("Cross", Cross(a_list[i], b_list[i]).x);
+    Benchmark("GetFrustumInWorldSpace", GetFrustumInWorldSpace(projection_mul_view_list[i]).center.x);
+
+    return(0);
+}
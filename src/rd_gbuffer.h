@@ -0,0 +1,88 @@
+#ifndef RD_GBUFFER_H
+#define RD_GBUFFER_H
+
+#include "glad/glad.h"
+
+// NOTE: g-buffer of the deferred mode, 16 bytes per pixel:
+//       0: RGBA8  albedo as sampled (srgb) in rgb, ambient occlusion in a
+//       1: RGBA16 octahedral normal in rg, roughness in b, metallic in a
+//       depth: DEPTH24_STENCIL8, world position is rebuilt from it
+//       The depth format matches the renderbuffer of the hdr framebuffer so it
+//       can be blitted there for the forward passes that come after lighting
+#define GBUFFER_ALBEDO_UNIT 0
+#define GBUFFER_NORMAL_MATERIAL_UNIT 1
+#define GBUFFER_DEPTH_UNIT 2
+
+struct g_buffer
+{
+    GLuint fbo;
+    GLuint albedo_ao;
+    GLuint normal_material;
+    GLuint depth;
+    u32 width;
+    u32 height;
+};
+
+INTERNAL GLuint GBufferTexture(GLenum internal_format, GLenum format, GLenum type, u32 width, u32 height)
+{
+    GLuint result;
+    glGenTextures(1, &result);
+    GLBindTexture(GL_TEXTURE_2D, result);
+    glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format, type, NULL);
+    // NOTE: the lighting pass reads one texel per pixel
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    return(result);
+}
+
+// NOTE: created with the size of the hdr framebuffer, CopyGBufferDepth blits between them 1:1
+g_buffer GBuffer(u32 width, u32 height)
+{
+    g_buffer result = {};
+    result.width = width;
+    result.height = height;
+    result.albedo_ao = GBufferTexture(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, width, height);
+    result.normal_material = GBufferTexture(GL_RGBA16, GL_RGBA, GL_UNSIGNED_SHORT, width, height);
+    result.depth = GBufferTexture(GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, width, height);
+    GLBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers(1, &result.fbo);
+    GLBindFramebuffer(GL_FRAMEBUFFER, result.fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, result.albedo_ao, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, result.normal_material, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, result.depth, 0);
+    GLenum attachments[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    glDrawBuffers(2, attachments);
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        Assert(!"framebuffer incomplete");
+    }
+    GLBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    return(result);
+}
+
+void BindGBufferTextures(g_buffer *buffer)
+{
+    GLActiveTexture(GL_TEXTURE0 + GBUFFER_ALBEDO_UNIT);
+    GLBindTexture(GL_TEXTURE_2D, buffer->albedo_ao);
+    GLActiveTexture(GL_TEXTURE0 + GBUFFER_NORMAL_MATERIAL_UNIT);
+    GLBindTexture(GL_TEXTURE_2D, buffer->normal_material);
+    GLActiveTexture(GL_TEXTURE0 + GBUFFER_DEPTH_UNIT);
+    GLBindTexture(GL_TEXTURE_2D, buffer->depth);
+}
+
+// NOTE: the forward passes after lighting (light cubes, skybox) test against the scene depth
+void CopyGBufferDepth(g_buffer *buffer, GLuint target_fbo)
+{
+    GLBindFramebuffer(GL_READ_FRAMEBUFFER, buffer->fbo);
+    GLBindFramebuffer(GL_DRAW_FRAMEBUFFER, target_fbo);
+    glBlitFramebuffer(0, 0, buffer->width, buffer->height, 0, 0, buffer->width, buffer->height,
+                      GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    GLBindFramebuffer(GL_FRAMEBUFFER, target_fbo);
+}
+
+#endif
@@ -0,0 +1,276 @@
+#ifndef RD_GL_STATE_H
+#define RD_GL_STATE_H
+
+#include "glad/glad.h"
+
+// NOTE: thin cache in front of the GL state the renderer touches every frame, calls
+//       that wouldn't change anything are dropped. Only valid as long as every change
+//       of the tracked state goes through these functions, so the raw gl calls for
+//       the same state shouldn't be used anywhere else
+#define GL_STATE_TEXTURE_UNIT_COUNT 32
+
+enum gl_state_texture_target
+{
+    GLStateTextureTarget_2D,
+    GLStateTextureTarget_2DArray,
+    GLStateTextureTarget_CubeMap,
+
+    GLStateTextureTarget_Count,
+};
+
+enum gl_state_capability
+{
+    GLStateCapability_DepthTest,
+    GLStateCapability_Blend,
+    GLStateCapability_CullFace,
+    GLStateCapability_DepthClamp,
+
+    GLStateCapability_Count,
+};
+
+struct gl_state
+{
+    GLuint program;
+    GLuint vao;
+    GLuint draw_fbo;
+    GLuint read_fbo;
+    u32 active_unit;
+    GLuint texture_list[GL_STATE_TEXTURE_UNIT_COUNT][GLStateTextureTarget_Count];
+    b32 capability_list[GLStateCapability_Count];
+    GLenum blend_source;
+    GLenum blend_destination;
+    GLenum blend_equation;
+    GLenum depth_func;
+    GLenum cull_face;
+    i32 viewport[4];
+
+    // NOTE: since the last ResetGLStateCounters
+    u64 issued_count;
+    u64 skipped_count;
+};
+
+// NOTE: starts from the defaults of a new context, the viewport
+//       isn't known so the first glViewport is always issued
+GLOBAL gl_state global_gl_state =
+{
+    0, 0, 0, 0, 0, {}, {}, GL_ONE, GL_ZERO, GL_FUNC_ADD, GL_LESS, GL_BACK, {-1, -1, -1, -1}, 0, 0
+};
+
+// NOTE: counts the call and returns true when it has to be issued
+inline b32 ChangeGLState(b32 is_changed)
+{
+    if(is_changed)
+    {
+        global_gl_state.issued_count++;
+    }
+    else
+    {
+        global_gl_state.skipped_count++;
+    }
+
+    return(is_changed);
+}
+
+void ResetGLStateCounters(void)
+{
+    global_gl_state.issued_count = 0;
+    global_gl_state.skipped_count = 0;
+}
+
+void GLUseProgram(GLuint program)
+{
+    if(ChangeGLState(global_gl_state.program != program))
+    {
+        global_gl_state.program = program;
+        glUseProgram(program);
+    }
+}
+
+void GLBindVertexArray(GLuint vao)
+{
+    if(ChangeGLState(global_gl_state.vao != vao))
+    {
+        global_gl_state.vao = vao;
+        glBindVertexArray(vao);
+    }
+}
+
+void GLBindFramebuffer(GLenum target, GLuint fbo)
+{
+    b32 is_changed = false;
+    if((target == GL_FRAMEBUFFER) || (target == GL_DRAW_FRAMEBUFFER))
+    {
+        is_changed |= (global_gl_state.draw_fbo != fbo);
+        global_gl_state.draw_fbo = fbo;
+    }
+    if((target == GL_FRAMEBUFFER) || (target == GL_READ_FRAMEBUFFER))
+    {
+        is_changed |= (global_gl_state.read_fbo != fbo);
+        global_gl_state.read_fbo = fbo;
+    }
+    if(ChangeGLState(is_changed))
+    {
+        glBindFramebuffer(target, fbo);
+    }
+}
+
+void GLActiveTexture(GLenum unit)
+{
+    u32 unit_index = unit - GL_TEXTURE0;
+    Assert(unit_index < GL_STATE_TEXTURE_UNIT_COUNT);
+    if(ChangeGLState(global_gl_state.active_unit != unit_index))
+    {
+        global_gl_state.active_unit = unit_index;
+        glActiveTexture(unit);
+    }
+}
+
+INTERNAL u32 GetGLStateTextureTarget(GLenum target)
+{
+    u32 result = GLStateTextureTarget_Count;
+    switch(target)
+    {
+        case GL_TEXTURE_2D: result = GLStateTextureTarget_2D; break;
+        case GL_TEXTURE_2D_ARRAY: result = GLStateTextureTarget_2DArray; break;
+        case GL_TEXTURE_CUBE_MAP: result = GLStateTextureTarget_CubeMap; break;
+    }
+
+    return(result);
+}
+
+// NOTE: binds to the active unit like glBindTexture, untracked targets are always issued
+void GLBindTexture(GLenum target, GLuint texture)
+{
+    u32 target_index = GetGLStateTextureTarget(target);
+    if(target_index == GLStateTextureTarget_Count)
+    {
+        ChangeGLState(true);
+        glBindTexture(target, texture);
+        return;
+    }
+    GLuint *bound_texture = &global_gl_state.texture_list[global_gl_state.active_unit][target_index];
+    if(ChangeGLState(*bound_texture != texture))
+    {
+        *bound_texture = texture;
+        glBindTexture(target, texture);
+    }
+}
+
+// NOTE: deleting a bound texture unbinds it, the cache has to forget it as well
+//       or a new texture that gets the same name would never be bound
+void GLDeleteTextures(u32 count, GLuint *texture_list)
+{
+    for(u32 i = 0; i < count; i++)
+    {
+        for(u32 unit = 0; unit < GL_STATE_TEXTURE_UNIT_COUNT; unit++)
+        {
+            for(u32 target_index = 0; target_index < GLStateTextureTarget_Count; target_index++)
+            {
+                if(global_gl_state.texture_list[unit][target_index] == texture_list[i])
+                {
+                    global_gl_state.texture_list[unit][target_index] = 0;
+                }
+            }
+        }
+    }
+    glDeleteTextures(count, texture_list);
+}
+
+INTERNAL u32 GetGLStateCapability(GLenum capability)
+{
+    u32 result = GLStateCapability_Count;
+    switch(capability)
+    {
+        case GL_DEPTH_TEST: result = GLStateCapability_DepthTest; break;
+        case GL_BLEND: result = GLStateCapability_Blend; break;
+        case GL_CULL_FACE: result = GLStateCapability_CullFace; break;
+        case GL_DEPTH_CLAMP: result = GLStateCapability_DepthClamp; break;
+    }
+
+    return(result);
+}
+
+// NOTE: untracked capabilities are always issued
+void SetGLCapability(GLenum capability, b32 enabled)
+{
+    u32 capability_index = GetGLStateCapability(capability);
+    b32 is_changed = true;
+    if(capability_index != GLStateCapability_Count)
+    {
+        is_changed = (global_gl_state.capability_list[capability_index] != enabled);
+        global_gl_state.capability_list[capability_index] = enabled;
+    }
+    if(ChangeGLState(is_changed))
+    {
+        if(enabled)
+        {
+            glEnable(capability);
+        }
+        else
+        {
+            glDisable(capability);
+        }
+    }
+}
+
+inline void GLEnable(GLenum capability)
+{
+    SetGLCapability(capability, true);
+}
+
+inline void GLDisable(GLenum capability)
+{
+    SetGLCapability(capability, false);
+}
+
+void GLBlendFunc(GLenum source, GLenum destination)
+{
+    if(ChangeGLState((global_gl_state.blend_source != source) || (global_gl_state.blend_destination != destination)))
+    {
+        global_gl_state.blend_source = source;
+        global_gl_state.blend_destination = destination;
+        glBlendFunc(source, destination);
+    }
+}
+
+void GLBlendEquation(GLenum equation)
+{
+    if(ChangeGLState(global_gl_state.blend_equation != equation))
+    {
+        global_gl_state.blend_equation = equation;
+        glBlendEquation(equation);
+    }
+}
+
+void GLDepthFunc(GLenum func)
+{
+    if(ChangeGLState(global_gl_state.depth_func != func))
+    {
+        global_gl_state.depth_func = func;
+        glDepthFunc(func);
+    }
+}
+
+void GLCullFace(GLenum face)
+{
+    if(ChangeGLState(global_gl_state.cull_face != face))
+    {
+        global_gl_state.cull_face = face;
+        glCullFace(face);
+    }
+}
+
+void GLViewport(i32 x, i32 y, i32 width, i32 height)
+{
+    i32 *viewport = global_gl_state.viewport;
+    if(ChangeGLState((viewport[0] != x) || (viewport[1] != y) || (viewport[2] != width) || (viewport[3] != height)))
+    {
+        viewport[0] = x;
+        viewport[1] = y;
+        viewport[2] = width;
+        viewport[3] = height;
+        glViewport(x, y, width, height);
+    }
+}
+
+#endif
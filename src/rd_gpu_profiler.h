@@ -0,0 +1,218 @@
+#ifndef RD_GPU_PROFILER_H
+#define RD_GPU_PROFILER_H
+
+#include "glad/glad.h"
+
+#include <algorithm>
+#include <stdio.h>
+
+// NOTE: a GL_TIMESTAMP query at the start and at the end of every pass. Unlike
+//       GL_TIME_ELAPSED they can overlap, so the whole frame is timed as well.
+//       Each frame has its own set of queries and the sets are reused in a ring of
+//       GPU_PROFILER_FRAME_COUNT frames. A set is only read when its results are
+//       available, otherwise the frame is dropped so the cpu never waits on the gpu.
+//       Every pass keeps the last GPU_PROFILER_SAMPLE_COUNT times for its statistics
+#define GPU_PROFILER_FRAME_COUNT 3
+#define GPU_PROFILER_SAMPLE_COUNT 256
+
+enum gpu_profiler_pass
+{
+    GPUProfilerPass_Frame,
+    GPUProfilerPass_Shadow,
+    GPUProfilerPass_DepthPrepass,
+    GPUProfilerPass_Opaque,
+    GPUProfilerPass_DeferredLighting,
+    GPUProfilerPass_LightCubes,
+    GPUProfilerPass_Skybox,
+    GPUProfilerPass_BloomDownsample,
+    GPUProfilerPass_BloomUpsample,
+    GPUProfilerPass_PostProcessing,
+    GPUProfilerPass_DebugQuad,
+
+    GPUProfilerPass_Count,
+};
+
+GLOBAL const char *gpu_profiler_pass_names[GPUProfilerPass_Count] =
+{
+    "frame", "shadow", "depth pre-pass", "opaque", "deferred lighting", "light cubes", "skybox",
+    "bloom downsample", "bloom upsample", "post processing", "debug quad",
+};
+
+struct gpu_profiler_frame
+{
+    // NOTE: begin and end timestamp of every pass
+    GLuint queries[GPUProfilerPass_Count][2];
+    b32 used[GPUProfilerPass_Count];
+    // NOTE: reset generation of the pass when it was timed
+    u32 generation[GPUProfilerPass_Count];
+    b32 pending;
+};
+
+// NOTE: ring of the last times in milliseconds
+struct gpu_pass_samples
+{
+    f32 sample_list[GPU_PROFILER_SAMPLE_COUNT];
+    u32 count;
+    u32 next;
+    // NOTE: bumped by ResetGPUPassSamples, queries from an older generation are dropped
+    u32 generation;
+};
+
+struct gpu_pass_stats
+{
+    u32 sample_count;
+    f32 average_ms;
+    f32 p50_ms;
+    f32 p95_ms;
+    f32 p99_ms;
+    f32 max_ms;
+};
+
+struct gpu_profiler
+{
+    gpu_profiler_frame frame_list[GPU_PROFILER_FRAME_COUNT];
+    u32 frame_index;
+    gpu_pass_samples pass_samples[GPUProfilerPass_Count];
+
+    // NOTE: frames read back and frames whose results weren't ready in time
+    u64 resolved_frame_count;
+    u64 dropped_frame_count;
+};
+
+gpu_profiler GPUProfiler(void)
+{
+    gpu_profiler result = {};
+    for(u32 frame = 0; frame < GPU_PROFILER_FRAME_COUNT; frame++)
+    {
+        glGenQueries(2 * GPUProfilerPass_Count, &result.frame_list[frame].queries[0][0]);
+    }
+
+    return(result);
+}
+
+INTERNAL void PushGPUPassSample(gpu_pass_samples *samples, f32 time_ms)
+{
+    samples->sample_list[samples->next] = time_ms;
+    samples->next = (samples->next + 1) % GPU_PROFILER_SAMPLE_COUNT;
+    samples->count = Minimum(samples->count + 1, (u32)GPU_PROFILER_SAMPLE_COUNT);
+}
+
+// NOTE: timestamps complete in order, so when the last one is available all of them are
+INTERNAL void ResolveGPUProfilerFrame(gpu_profiler *profiler, gpu_profiler_frame *frame)
+{
+    GLint available = GL_FALSE;
+    glGetQueryObjectiv(frame->queries[GPUProfilerPass_Frame][1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if(!available)
+    {
+        profiler->dropped_frame_count++;
+        return;
+    }
+    for(u32 pass = 0; pass < GPUProfilerPass_Count; pass++)
+    {
+        // NOTE: the pass was reset while the queries were in flight, they time the old mode
+        if(!frame->used[pass] || (frame->generation[pass] != profiler->pass_samples[pass].generation))
+        {
+            continue;
+        }
+        GLuint64 begin_ns = 0;
+        GLuint64 end_ns = 0;
+        glGetQueryObjectui64v(frame->queries[pass][0], GL_QUERY_RESULT, &begin_ns);
+        glGetQueryObjectui64v(frame->queries[pass][1], GL_QUERY_RESULT, &end_ns);
+        PushGPUPassSample(&profiler->pass_samples[pass], (f32)((f64)(end_ns - begin_ns) / 1000000.0));
+    }
+    profiler->resolved_frame_count++;
+}
+
+// NOTE: reads back the frame that used this set of queries GPU_PROFILER_FRAME_COUNT frames ago
+void BeginGPUProfilerFrame(gpu_profiler *profiler)
+{
+    gpu_profiler_frame *frame = &profiler->frame_list[profiler->frame_index % GPU_PROFILER_FRAME_COUNT];
+    if(frame->pending)
+    {
+        ResolveGPUProfilerFrame(profiler, frame);
+        frame->pending = false;
+    }
+    memset(frame->used, 0, sizeof(frame->used));
+    glQueryCounter(frame->queries[GPUProfilerPass_Frame][0], GL_TIMESTAMP);
+}
+
+void EndGPUProfilerFrame(gpu_profiler *profiler)
+{
+    gpu_profiler_frame *frame = &profiler->frame_list[profiler->frame_index % GPU_PROFILER_FRAME_COUNT];
+    glQueryCounter(frame->queries[GPUProfilerPass_Frame][1], GL_TIMESTAMP);
+    frame->used[GPUProfilerPass_Frame] = true;
+    frame->generation[GPUProfilerPass_Frame] = profiler->pass_samples[GPUProfilerPass_Frame].generation;
+    frame->pending = true;
+    profiler->frame_index++;
+}
+
+// NOTE: a pass can be timed once per frame, passes that are skipped add no sample
+void BeginGPUPass(gpu_profiler *profiler, u32 pass)
+{
+    Assert((pass != GPUProfilerPass_Frame) && (pass < GPUProfilerPass_Count));
+    gpu_profiler_frame *frame = &profiler->frame_list[profiler->frame_index % GPU_PROFILER_FRAME_COUNT];
+    glQueryCounter(frame->queries[pass][0], GL_TIMESTAMP);
+}
+
+void EndGPUPass(gpu_profiler *profiler, u32 pass)
+{
+    gpu_profiler_frame *frame = &profiler->frame_list[profiler->frame_index % GPU_PROFILER_FRAME_COUNT];
+    glQueryCounter(frame->queries[pass][1], GL_TIMESTAMP);
+    frame->used[pass] = true;
+    frame->generation[pass] = profiler->pass_samples[pass].generation;
+}
+
+// NOTE: for when the pass changes what it does, so the old times don't mix with the new ones
+void ResetGPUPassSamples(gpu_profiler *profiler, u32 pass)
+{
+    profiler->pass_samples[pass].count = 0;
+    profiler->pass_samples[pass].next = 0;
+    profiler->pass_samples[pass].generation++;
+}
+
+// NOTE: nearest rank percentiles of the samples in the window, false if there are none
+b32 GetGPUPassStats(gpu_profiler *profiler, u32 pass, gpu_pass_stats *stats)
+{
+    gpu_pass_samples *samples = &profiler->pass_samples[pass];
+    if(samples->count == 0)
+    {
+        return(false);
+    }
+    f32 sorted_list[GPU_PROFILER_SAMPLE_COUNT];
+    f32 total_ms = 0.0f;
+    for(u32 i = 0; i < samples->count; i++)
+    {
+        sorted_list[i] = samples->sample_list[i];
+        total_ms += sorted_list[i];
+    }
+    std::sort(sorted_list, sorted_list + samples->count);
+
+    u32 last = samples->count - 1;
+    stats->sample_count = samples->count;
+    stats->average_ms = total_ms / samples->count;
+    stats->p50_ms = sorted_list[(u32)(0.50f * last + 0.5f)];
+    stats->p95_ms = sorted_list[(u32)(0.95f * last + 0.5f)];
+    stats->p99_ms = sorted_list[(u32)(0.99f * last + 0.5f)];
+    stats->max_ms = sorted_list[last];
+
+    return(true);
+}
+
+// NOTE: passes that weren't run in the window are left out
+void PrintGPUProfilerReport(gpu_profiler *profiler)
+{
+    printf("gpu passes (ms)        avg     p50     p95     p99     max  samples\n");
+    for(u32 pass = 0; pass < GPUProfilerPass_Count; pass++)
+    {
+        gpu_pass_stats stats;
+        if(GetGPUPassStats(profiler, pass, &stats))
+        {
+            printf("  %-18s %7.3f %7.3f %7.3f %7.3f %7.3f  %u\n", gpu_profiler_pass_names[pass], stats.average_ms,
+                   stats.p50_ms, stats.p95_ms, stats.p99_ms, stats.max_ms, stats.sample_count);
+        }
+    }
+    printf("  %llu frames read back, %llu dropped because they weren't ready\n",
+           (unsigned long long)profiler->resolved_frame_count, (unsigned long long)profiler->dropped_frame_count);
+}
+
+#endif
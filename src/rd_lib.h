@@ -4,6 +4,19 @@
 #include "float.h"
 #include "math.h"
 
+// NOTE: the SIMD path is chosen at compile time from the target flags (-msse2, -mavx, ...),
+//       define RD_NO_SIMD to force the scalar fallback. Both paths perform the same
+//       operations in the same order so they give bit-for-bit identical results, as long
+//       as the compiler is not allowed to contract mul+add into fma (-ffp-contract=off)
+#if !defined(RD_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define RD_SIMD_SSE 1
+#include "emmintrin.h"
+#if defined(__AVX__)
+#define RD_SIMD_AVX 1
+#include "immintrin.h"
+#endif
+#endif
+
 #define INTERNAL static
 #define LOCAL static
 #define GLOBAL static
@@ -79,6 +92,13 @@ inline f32 Square(f32 a)
     return(result);
 }
 
+inline f32 Clamp(f32 value, f32 min, f32 max)
+{
+    f32 result = Minimum(Maximum(value, min), max);
+
+    return(result);
+}
+
 inline f32 Cosine(f32 theta)
 {
     f32 result = cosf(theta);
@@ -462,10 +482,14 @@ inline f32 DotProduct(vec4 a, vec4 b)
 inline vec4 operator/(vec4 a, f32 b)
 {
     vec4 result;
+#if RD_SIMD_SSE
+    _mm_storeu_ps(&result.e[0], _mm_div_ps(_mm_loadu_ps(&a.e[0]), _mm_set1_ps(b)));
+#else
     result.x = a.x / b;
     result.y = a.y / b;
     result.z = a.z / b;
     result.w = a.w / b;
+#endif
 
     return(result);
 }
@@ -477,6 +501,56 @@ inline vec4 &operator/=(vec4 &a, f32 b)
     return(a);
 }
 
+inline u32 CountSetBits(u32 value)
+{
+    u32 result = 0;
+    while(value)
+    {
+        value &= value - 1;
+        result++;
+    }
+
+    return(result);
+}
+
+// NOTE: FNV-1a, pass the previous result as seed to hash several blocks
+inline u32 HashBytes(void *data, u64 size, u32 seed = 2166136261u)
+{
+    u32 result = seed;
+    for(u64 i = 0; i < size; i++)
+    {
+        result ^= ((u8 *)data)[i];
+        result *= 16777619u;
+    }
+
+    return(result);
+}
+
+inline u64 HashBytes64(void *data, u64 size, u64 seed = 14695981039346656037ull)
+{
+    u64 result = seed;
+    for(u64 i = 0; i < size; i++)
+    {
+        result ^= ((u8 *)data)[i];
+        result *= 1099511628211ull;
+    }
+
+    return(result);
+}
+
+// NOTE: FNV-1a
+inline u32 HashString(const char *str)
+{
+    u32 result = 2166136261u;
+    for(const char *c = str; *c; c++)
+    {
+        result ^= (u8)(*c);
+        result *= 16777619u;
+    }
+
+    return(result);
+}
+
 struct rect3
 {
     vec3 min;
@@ -550,14 +624,14 @@ inline mat4x4 Mat4x4(mat3x3 m3)
     return(result); 
 }
 
-inline mat4x4 operator*(mat4x4 A, mat4x4 B)
+inline mat4x4 MultiplyScalar(mat4x4 A, mat4x4 B)
 {
     mat4x4 C = {{
         {0, 0, 0, 0},
         {0, 0, 0, 0},
         {0, 0, 0, 0},
         {0, 0, 0, 0}
-    }};;
+    }};
     for(i32 i = 0; i < 4; i++)
     {
         for(i32 j = 0; j < 4; j++)
@@ -572,7 +646,7 @@ inline mat4x4 operator*(mat4x4 A, mat4x4 B)
     return(C);
 }
 
-inline vec4 operator*(mat4x4 A, vec4 b)
+inline vec4 MultiplyScalar(mat4x4 A, vec4 b)
 {
     vec4 result = {};
     for(i32 i = 0; i < 4; i++)
@@ -583,6 +657,81 @@ inline vec4 operator*(mat4x4 A, vec4 b)
     return(result);
 }
 
+// NOTE: row i of C is the sum over k of A[i][k] * (row k of B), accumulated
+//       starting from zero and in increasing k like the scalar version
+inline mat4x4 operator*(mat4x4 A, mat4x4 B)
+{
+#if RD_SIMD_AVX
+    mat4x4 C;
+    __m256 b0 = _mm256_broadcast_ps((__m128 *)&B.e[0][0]);
+    __m256 b1 = _mm256_broadcast_ps((__m128 *)&B.e[1][0]);
+    __m256 b2 = _mm256_broadcast_ps((__m128 *)&B.e[2][0]);
+    __m256 b3 = _mm256_broadcast_ps((__m128 *)&B.e[3][0]);
+    // NOTE: two rows of A per register, permute broadcasts A[i][k] within each 128 bit lane
+    for(i32 i = 0; i < 4; i += 2)
+    {
+        __m256 a = _mm256_loadu_ps(&A.e[i][0]);
+        __m256 c = _mm256_setzero_ps();
+        c = _mm256_add_ps(c, _mm256_mul_ps(_mm256_permute_ps(a, 0x00), b0));
+        c = _mm256_add_ps(c, _mm256_mul_ps(_mm256_permute_ps(a, 0x55), b1));
+        c = _mm256_add_ps(c, _mm256_mul_ps(_mm256_permute_ps(a, 0xAA), b2));
+        c = _mm256_add_ps(c, _mm256_mul_ps(_mm256_permute_ps(a, 0xFF), b3));
+        _mm256_storeu_ps(&C.e[i][0], c);
+    }
+
+    return(C);
+#elif RD_SIMD_SSE
+    mat4x4 C;
+    __m128 b0 = _mm_loadu_ps(&B.e[0][0]);
+    __m128 b1 = _mm_loadu_ps(&B.e[1][0]);
+    __m128 b2 = _mm_loadu_ps(&B.e[2][0]);
+    __m128 b3 = _mm_loadu_ps(&B.e[3][0]);
+    for(i32 i = 0; i < 4; i++)
+    {
+        __m128 a = _mm_loadu_ps(&A.e[i][0]);
+        __m128 c = _mm_setzero_ps();
+        c = _mm_add_ps(c, _mm_mul_ps(_mm_shuffle_ps(a, a, 0x00), b0));
+        c = _mm_add_ps(c, _mm_mul_ps(_mm_shuffle_ps(a, a, 0x55), b1));
+        c = _mm_add_ps(c, _mm_mul_ps(_mm_shuffle_ps(a, a, 0xAA), b2));
+        c = _mm_add_ps(c, _mm_mul_ps(_mm_shuffle_ps(a, a, 0xFF), b3));
+        _mm_storeu_ps(&C.e[i][0], c);
+    }
+
+    return(C);
+#else
+    mat4x4 C = MultiplyScalar(A, B);
+
+    return(C);
+#endif
+}
+
+// NOTE: the SIMD version works on the columns of A so that every lane
+//       computes x*x + y*y + z*z + w*w in the same order as DotProduct
+inline vec4 operator*(mat4x4 A, vec4 b)
+{
+#if RD_SIMD_SSE
+    __m128 c0 = _mm_loadu_ps(&A.e[0][0]);
+    __m128 c1 = _mm_loadu_ps(&A.e[1][0]);
+    __m128 c2 = _mm_loadu_ps(&A.e[2][0]);
+    __m128 c3 = _mm_loadu_ps(&A.e[3][0]);
+    _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+
+    __m128 r = _mm_mul_ps(c0, _mm_set1_ps(b.x));
+    r = _mm_add_ps(r, _mm_mul_ps(c1, _mm_set1_ps(b.y)));
+    r = _mm_add_ps(r, _mm_mul_ps(c2, _mm_set1_ps(b.z)));
+    r = _mm_add_ps(r, _mm_mul_ps(c3, _mm_set1_ps(b.w)));
+
+    vec4 result;
+    _mm_storeu_ps(&result.e[0], r);
+    
+    return(result);
+#else
+    vec4 result = MultiplyScalar(A, b);
+
+    return(result);
+#endif
+}
+
 inline vec3 operator*(mat4x4 A, vec3 b)
 {
     vec4 c = Vec4(b, 1.0f);
@@ -794,12 +943,26 @@ mat4x4 LookAt(vec3 eye_position, vec3 target, vec3 camera_up)
 
 mat4x4 Transpose(mat4x4 A)
 {
+#if RD_SIMD_SSE
+    __m128 r0 = _mm_loadu_ps(&A.e[0][0]);
+    __m128 r1 = _mm_loadu_ps(&A.e[1][0]);
+    __m128 r2 = _mm_loadu_ps(&A.e[2][0]);
+    __m128 r3 = _mm_loadu_ps(&A.e[3][0]);
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+
+    mat4x4 result;
+    _mm_storeu_ps(&result.e[0][0], r0);
+    _mm_storeu_ps(&result.e[1][0], r1);
+    _mm_storeu_ps(&result.e[2][0], r2);
+    _mm_storeu_ps(&result.e[3][0], r3);
+#else
     mat4x4 result = {{
         {A.e[0][0], A.e[1][0], A.e[2][0], A.e[3][0]},
         {A.e[0][1], A.e[1][1], A.e[2][1], A.e[3][1]},
         {A.e[0][2], A.e[1][2], A.e[2][2], A.e[3][2]},
         {A.e[0][3], A.e[1][3], A.e[2][3], A.e[3][3]},
     }};
+#endif
 
     return(result);
 }
@@ -876,6 +1039,42 @@ mat4x4 Inverse(mat4x4 A)
     return(result);
 }
 
+inline b32 IsAffine(mat4x4 A)
+{
+    b32 result = ((A.e[3][0] == 0.0f) &&
+                  (A.e[3][1] == 0.0f) &&
+                  (A.e[3][2] == 0.0f) &&
+                  (A.e[3][3] == 1.0f));
+
+    return(result);
+}
+
+// NOTE: transpose(inverse(M)) of the upper 3x3 of A, which is the cofactor
+//       matrix of M divided by its determinant, no need to go through the 4x4 inverse
+mat3x3 InverseTranspose3x3(mat4x4 A)
+{
+    f32 c00 = A.e[1][1] * A.e[2][2] - A.e[1][2] * A.e[2][1];
+    f32 c01 = A.e[1][2] * A.e[2][0] - A.e[1][0] * A.e[2][2];
+    f32 c02 = A.e[1][0] * A.e[2][1] - A.e[1][1] * A.e[2][0];
+    f32 c10 = A.e[0][2] * A.e[2][1] - A.e[0][1] * A.e[2][2];
+    f32 c11 = A.e[0][0] * A.e[2][2] - A.e[0][2] * A.e[2][0];
+    f32 c12 = A.e[0][1] * A.e[2][0] - A.e[0][0] * A.e[2][1];
+    f32 c20 = A.e[0][1] * A.e[1][2] - A.e[0][2] * A.e[1][1];
+    f32 c21 = A.e[0][2] * A.e[1][0] - A.e[0][0] * A.e[1][2];
+    f32 c22 = A.e[0][0] * A.e[1][1] - A.e[0][1] * A.e[1][0];
+
+    f32 d = 1.0f / (A.e[0][0] * c00 + A.e[0][1] * c01 + A.e[0][2] * c02);
+
+    mat3x3 result =
+    {{
+        {d * c00, d * c01, d * c02},
+        {d * c10, d * c11, d * c12},
+        {d * c20, d * c21, d * c22},
+    }};
+
+    return(result);
+}
+
 vec3 GetRectangleCenter(vec3 min_corner, vec3 max_corner)
 {
     f32 x = (min_corner.x + max_corner.x) / 2.0f;
@@ -893,6 +1092,235 @@ vec3 GetRectangleCenter(rect3 rect)
     return(result);
 }
 
+struct frustum
+{
+    vec4 corners[8];
+    vec3 center;
+};
+vec3 GetFrustumCenter(frustum f)
+{
+    vec3 center = Vec3(0.0f, 0.0f, 0.0f);
+    for(u32 i = 0; i < ArrayCount(f.corners); i++)
+    {
+        center += Vec3(f.corners[i]);
+    }
+    center /= ArrayCount(f.corners);
+
+    return(center);
+}
+
+frustum GetFrustumInWorldSpace(mat4x4 projection_mul_view)
+{
+    mat4x4 to_world_space = Inverse(projection_mul_view);
+
+    frustum f = {{
+        Vec4(-1.0f, -1.0f, -1.0f, 1.0f),
+        Vec4(-1.0f, -1.0f, 1.0f, 1.0f),
+        Vec4(-1.0f, 1.0f, -1.0f, 1.0f),
+        Vec4(-1.0f, 1.0f, 1.0f, 1.0f),
+        Vec4(1.0f, -1.0f, -1.0f, 1.0f),
+        Vec4(1.0f, -1.0f, 1.0f, 1.0f),
+        Vec4(1.0f, 1.0f, -1.0f, 1.0f),
+        Vec4(1.0f, 1.0f, 1.0f, 1.0f),
+    }};
+
+    for(u32 i = 0; i < ArrayCount(f.corners); i++)
+    {
+        f.corners[i] = to_world_space * f.corners[i];
+        f.corners[i] /= f.corners[i].w;
+    }
+
+    f.center = GetFrustumCenter(f);
+
+    return(f);
+}
+
+frustum GetFrustumInWorldSpace(mat4x4 projection, mat4x4 view)
+{
+    mat4x4 projection_mul_view = projection * view;
+    frustum result = GetFrustumInWorldSpace(projection_mul_view);
+
+    return(result);
+}
+
+// NOTE: planes are stored as (normal, d) with points inside the frustum
+//       satisfying dot(normal, p) + d >= 0, the normals are not normalized
+struct frustum_planes
+{
+    vec4 planes[6];
+};
+
+// NOTE: Gribb-Hartmann plane extraction, works for both perspective
+//       and orthographic matrices. Order: left, right, bottom, top, near, far
+frustum_planes GetFrustumPlanes(mat4x4 projection_mul_view)
+{
+    mat4x4 m = projection_mul_view;
+    vec4 row0 = Vec4(m.e[0][0], m.e[0][1], m.e[0][2], m.e[0][3]);
+    vec4 row1 = Vec4(m.e[1][0], m.e[1][1], m.e[1][2], m.e[1][3]);
+    vec4 row2 = Vec4(m.e[2][0], m.e[2][1], m.e[2][2], m.e[2][3]);
+    vec4 row3 = Vec4(m.e[3][0], m.e[3][1], m.e[3][2], m.e[3][3]);
+
+    frustum_planes result;
+    for(i32 i = 0; i < 4; i++)
+    {
+        result.planes[0].e[i] = row3.e[i] + row0.e[i];
+        result.planes[1].e[i] = row3.e[i] - row0.e[i];
+        result.planes[2].e[i] = row3.e[i] + row1.e[i];
+        result.planes[3].e[i] = row3.e[i] - row1.e[i];
+        result.planes[4].e[i] = row3.e[i] + row2.e[i];
+        result.planes[5].e[i] = row3.e[i] - row2.e[i];
+    }
+
+    return(result);
+}
+
+// NOTE: world space bounds of a transformed box, the center is transformed
+//       and the extents are projected on the axes with the absolute values of the matrix
+rect3 TransformRect3(mat4x4 A, rect3 rect)
+{
+    vec3 center = GetRectangleCenter(rect);
+    vec3 extents = (rect.max - rect.min) * 0.5f;
+    vec3 new_center = A * center;
+    vec3 new_extents;
+    for(i32 i = 0; i < 3; i++)
+    {
+        new_extents.e[i] = (fabsf(A.e[i][0]) * extents.x +
+                            fabsf(A.e[i][1]) * extents.y +
+                            fabsf(A.e[i][2]) * extents.z);
+    }
+    rect3 result = Rect3(new_center - new_extents, new_center + new_extents);
+
+    return(result);
+}
+
+// NOTE: conservative, a box is rejected only if it is fully behind one of the planes,
+//       plane_count = 4 only tests the side planes and ignores near and far
+b32 IsRectInFrustum(frustum_planes *frustum, rect3 rect, u32 plane_count = 6)
+{
+    Assert(plane_count <= ArrayCount(frustum->planes));
+    vec3 center = GetRectangleCenter(rect);
+    vec3 extents = (rect.max - rect.min) * 0.5f;
+    for(u32 plane_index = 0; plane_index < plane_count; plane_index++)
+    {
+        vec4 plane = frustum->planes[plane_index];
+        f32 distance = plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w;
+        f32 radius = fabsf(plane.x) * extents.x + fabsf(plane.y) * extents.y + fabsf(plane.z) * extents.z;
+        if(distance + radius < 0.0f)
+        {
+            return(false);
+        }
+    }
+
+    return(true);
+}
+
+// NOTE: structure of arrays input for ComputeTransforms, rotation[row * 3 + column]
+//       points to the array holding that element of the 3x3 rotation of every transform
+struct transform_batch
+{
+    u32 count;
+    f32 *position_x;
+    f32 *position_y;
+    f32 *position_z;
+    f32 *scale_x;
+    f32 *scale_y;
+    f32 *scale_z;
+    f32 *rotation[9];
+};
+
+// NOTE: writes model = Translation(p) * R * Scaling(s) and normal = transpose(inverse(M))
+//       for every transform in the batch, where M is the upper 3x3 of the model. R doesn't
+//       have to be orthonormal (a rotation accumulated every frame drifts away from it),
+//       the normal matrix is the cofactor matrix of M over its determinant like in
+//       InverseTranspose3x3
+void ComputeTransforms(transform_batch *batch, mat4x4 *model_list, mat3x3 *normal_list)
+{
+    u32 index = 0;
+#if RD_SIMD_SSE
+    __m128 one = _mm_set1_ps(1.0f);
+    for(; index + 4 <= batch->count; index += 4)
+    {
+        __m128 p[3] =
+        {
+            _mm_loadu_ps(batch->position_x + index),
+            _mm_loadu_ps(batch->position_y + index),
+            _mm_loadu_ps(batch->position_z + index),
+        };
+        __m128 s[3] =
+        {
+            _mm_loadu_ps(batch->scale_x + index),
+            _mm_loadu_ps(batch->scale_y + index),
+            _mm_loadu_ps(batch->scale_z + index),
+        };
+
+        // NOTE: each register holds one matrix element for 4 transforms,
+        //       a 4x4 transpose turns that back into one row per transform
+        __m128 m[9];
+        for(i32 element = 0; element < 9; element++)
+        {
+            m[element] = _mm_mul_ps(_mm_loadu_ps(batch->rotation[element] + index), s[element % 3]);
+        }
+#define RD_COFACTOR(a, b, c, d) _mm_sub_ps(_mm_mul_ps(m[a], m[b]), _mm_mul_ps(m[c], m[d]))
+        __m128 cofactors[9] =
+        {
+            RD_COFACTOR(4, 8, 5, 7), RD_COFACTOR(5, 6, 3, 8), RD_COFACTOR(3, 7, 4, 6),
+            RD_COFACTOR(2, 7, 1, 8), RD_COFACTOR(0, 8, 2, 6), RD_COFACTOR(1, 6, 0, 7),
+            RD_COFACTOR(1, 5, 2, 4), RD_COFACTOR(2, 3, 0, 5), RD_COFACTOR(0, 4, 1, 3),
+        };
+#undef RD_COFACTOR
+        __m128 determinant = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[0], cofactors[0]), _mm_mul_ps(m[1], cofactors[1])),
+                                        _mm_mul_ps(m[2], cofactors[2]));
+        __m128 inv_determinant = _mm_div_ps(one, determinant);
+        f32 normal_elements[9][4];
+        for(i32 element = 0; element < 9; element++)
+        {
+            _mm_storeu_ps(normal_elements[element], _mm_mul_ps(cofactors[element], inv_determinant));
+        }
+
+        for(i32 row = 0; row < 3; row++)
+        {
+            __m128 m0 = m[row * 3 + 0];
+            __m128 m1 = m[row * 3 + 1];
+            __m128 m2 = m[row * 3 + 2];
+            __m128 m3 = p[row];
+            _MM_TRANSPOSE4_PS(m0, m1, m2, m3);
+            _mm_storeu_ps(&model_list[index + 0].e[row][0], m0);
+            _mm_storeu_ps(&model_list[index + 1].e[row][0], m1);
+            _mm_storeu_ps(&model_list[index + 2].e[row][0], m2);
+            _mm_storeu_ps(&model_list[index + 3].e[row][0], m3);
+        }
+        __m128 last_row = _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f);
+        for(i32 i = 0; i < 4; i++)
+        {
+            _mm_storeu_ps(&model_list[index + i].e[3][0], last_row);
+            for(i32 element = 0; element < 9; element++)
+            {
+                normal_list[index + i].e[element / 3][element % 3] = normal_elements[element][i];
+            }
+        }
+    }
+#endif
+    for(; index < batch->count; index++)
+    {
+        f32 p[3] = {batch->position_x[index], batch->position_y[index], batch->position_z[index]};
+        f32 s[3] = {batch->scale_x[index], batch->scale_y[index], batch->scale_z[index]};
+        mat4x4 *model = model_list + index;
+        for(i32 row = 0; row < 3; row++)
+        {
+            for(i32 column = 0; column < 3; column++)
+            {
+                model->e[row][column] = batch->rotation[row * 3 + column][index] * s[column];
+            }
+            model->e[row][3] = p[row];
+        }
+        model->e[3][0] = 0.0f;
+        model->e[3][1] = 0.0f;
+        model->e[3][2] = 0.0f;
+        model->e[3][3] = 1.0f;
+        normal_list[index] = InverseTranspose3x3(*model);
+    }
+}
+
 #include "stdio.h"
 
 void PrintMatrix(mat4x4 A)
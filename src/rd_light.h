@@ -0,0 +1,300 @@
+#ifndef RD_LIGHT_H
+#define RD_LIGHT_H
+
+#include "glad/glad.h"
+
+#include <vector>
+#include <stdlib.h>
+
+// NOTE: clustered forward lighting. The view frustum is split in a grid of froxels,
+//       screen space tiles in x and y and exponential slices of view depth in z.
+//       Every frame the point lights are assigned on the cpu to the clusters their
+//       sphere of influence overlaps, the pbr shader finds the cluster of the fragment
+//       and only evaluates the lights in its list. The sun is not a point light
+//       anymore and goes through the frame uniforms
+#define CLUSTER_GRID_X 16
+#define CLUSTER_GRID_Y 9
+#define CLUSTER_GRID_Z 24
+#define CLUSTER_COUNT (CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z)
+
+#define LIGHT_SSBO_BINDING 2
+#define CLUSTER_SSBO_BINDING 3
+#define LIGHT_INDEX_SSBO_BINDING 4
+
+// NOTE: the attenuation is windowed so it reaches zero at the radius,
+//       nothing past it is lit and the clusters can be exact
+struct point_light
+{
+    vec3 position;
+    vec3 color;
+    f32 radius;
+};
+
+// NOTE: std430 mirrors of the buffers in pbr.fs.glsl
+struct light_data
+{
+    // NOTE: xyz = position, w = radius
+    vec4 position_radius;
+    vec4 color;
+};
+
+struct cluster_data
+{
+    u32 offset;
+    u32 count;
+};
+
+static_assert(sizeof(light_data) == 32, "light_data std430 layout error");
+static_assert(sizeof(cluster_data) == 8, "cluster_data std430 layout error");
+
+struct light_clusters
+{
+    GLuint light_ssbo;
+    GLuint cluster_ssbo;
+    GLuint index_ssbo;
+    u32 light_capacity;
+    u32 index_capacity;
+
+    // NOTE: of the last build
+    u32 index_count;
+    u32 max_cluster_light_count;
+};
+
+// NOTE: view depth to z slice, the shader does the same with the values of
+//       GetClusterDepthSlicing so both always agree on the slice of a depth
+struct cluster_depth_slicing
+{
+    f32 near_plane;
+    f32 far_plane;
+    f32 scale;
+    f32 bias;
+};
+
+cluster_depth_slicing GetClusterDepthSlicing(f32 near_plane, f32 far_plane)
+{
+    cluster_depth_slicing result;
+    result.near_plane = near_plane;
+    result.far_plane = far_plane;
+    result.scale = CLUSTER_GRID_Z / logf(far_plane / near_plane);
+    result.bias = result.scale * logf(near_plane);
+
+    return(result);
+}
+
+inline u32 GetClusterSlice(cluster_depth_slicing *slicing, f32 depth)
+{
+    depth = Clamp(depth, slicing->near_plane, slicing->far_plane);
+    i32 slice = (i32)(logf(depth) * slicing->scale - slicing->bias);
+    u32 result = (u32)Clamp((f32)slice, 0.0f, (f32)(CLUSTER_GRID_Z - 1));
+
+    return(result);
+}
+
+light_clusters LightClusters(void)
+{
+    light_clusters result = {};
+    glGenBuffers(1, &result.light_ssbo);
+    glGenBuffers(1, &result.cluster_ssbo);
+    glGenBuffers(1, &result.index_ssbo);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, result.cluster_ssbo);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, CLUSTER_COUNT * sizeof(cluster_data), NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    return(result);
+}
+
+// NOTE: grows the buffer to fit size, the contents are replaced every frame anyway
+INTERNAL void UploadStorageBuffer(GLuint ssbo, u32 *capacity, u32 count, u32 element_size, void *data)
+{
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
+    if(count > *capacity)
+    {
+        *capacity = Maximum(count, *capacity * 2);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, (u64)*capacity * element_size, NULL, GL_DYNAMIC_DRAW);
+    }
+    if(count > 0)
+    {
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, (u64)count * element_size, data);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+struct cluster_range
+{
+    u32 min[3];
+    u32 max[3];
+};
+
+// NOTE: conservative range of clusters overlapped by the view space aabb of the light sphere,
+//       returns false if the light is outside the view depth range
+INTERNAL b32 GetLightClusterRange(cluster_range *range, mat4x4 *projection, cluster_depth_slicing *slicing,
+                                  vec3 view_position, f32 radius)
+{
+    f32 depth = -view_position.z;
+    if((depth + radius < slicing->near_plane) || (depth - radius > slicing->far_plane))
+    {
+        return(false);
+    }
+    range->min[2] = GetClusterSlice(slicing, depth - radius);
+    range->max[2] = GetClusterSlice(slicing, depth + radius);
+
+    // NOTE: a sphere that crosses the near plane can cover any tile
+    if(depth - radius < slicing->near_plane)
+    {
+        range->min[0] = 0;
+        range->min[1] = 0;
+        range->max[0] = CLUSTER_GRID_X - 1;
+        range->max[1] = CLUSTER_GRID_Y - 1;
+        return(true);
+    }
+
+    vec2 ndc_min = Vec2(FLT_MAX, FLT_MAX);
+    vec2 ndc_max = Vec2(-FLT_MAX, -FLT_MAX);
+    for(u32 corner = 0; corner < 8; corner++)
+    {
+        vec3 offset = Vec3((corner & 1) ? radius : -radius, (corner & 2) ? radius : -radius,
+                           (corner & 4) ? radius : -radius);
+        vec4 clip = (*projection) * Vec4(view_position + offset, 1.0f);
+        vec2 ndc = Vec2(clip.x / clip.w, clip.y / clip.w);
+        ndc_min = Vec2(Minimum(ndc_min.x, ndc.x), Minimum(ndc_min.y, ndc.y));
+        ndc_max = Vec2(Maximum(ndc_max.x, ndc.x), Maximum(ndc_max.y, ndc.y));
+    }
+    if((ndc_max.x < -1.0f) || (ndc_min.x > 1.0f) || (ndc_max.y < -1.0f) || (ndc_min.y > 1.0f))
+    {
+        return(false);
+    }
+    u32 grid[2] = {CLUSTER_GRID_X, CLUSTER_GRID_Y};
+    f32 min_list[2] = {ndc_min.x, ndc_min.y};
+    f32 max_list[2] = {ndc_max.x, ndc_max.y};
+    for(u32 axis = 0; axis < 2; axis++)
+    {
+        f32 last_tile = (f32)(grid[axis] - 1);
+        range->min[axis] = (u32)Clamp((min_list[axis] * 0.5f + 0.5f) * grid[axis], 0.0f, last_tile);
+        range->max[axis] = (u32)Clamp((max_list[axis] * 0.5f + 0.5f) * grid[axis], 0.0f, last_tile);
+    }
+
+    return(true);
+}
+
+inline u32 GetClusterIndex(u32 x, u32 y, u32 z)
+{
+    u32 result = (z * CLUSTER_GRID_Y + y) * CLUSTER_GRID_X + x;
+
+    return(result);
+}
+
+// NOTE: counting sort of the (cluster, light) pairs, the first pass counts the lights
+//       of every cluster and the second fills the index list at the prefix sums.
+//       Everything is staged in the transient arena and uploaded at the end
+void BuildLightClusters(light_clusters *clusters, point_light *light_list, u32 light_count,
+                        mat4x4 view, mat4x4 projection, f32 near_plane, f32 far_plane,
+                        memory_arena *transient_arena)
+{
+    cluster_depth_slicing slicing = GetClusterDepthSlicing(near_plane, far_plane);
+    light_data *gpu_light_list = PushArray(transient_arena, light_count, light_data);
+    cluster_range *range_list = PushArray(transient_arena, light_count, cluster_range);
+    b32 *visible_list = PushArray(transient_arena, light_count, b32);
+    cluster_data *cluster_list = PushArray(transient_arena, CLUSTER_COUNT, cluster_data);
+    memset(cluster_list, 0, CLUSTER_COUNT * sizeof(cluster_data));
+
+    for(u32 light_index = 0; light_index < light_count; light_index++)
+    {
+        point_light *light = &light_list[light_index];
+        gpu_light_list[light_index].position_radius = Vec4(light->position, light->radius);
+        gpu_light_list[light_index].color = Vec4(light->color, 0.0f);
+
+        vec4 view_position = view * Vec4(light->position, 1.0f);
+        cluster_range *range = &range_list[light_index];
+        visible_list[light_index] = GetLightClusterRange(range, &projection, &slicing, view_position.xyz,
+                                                         light->radius);
+        if(!visible_list[light_index])
+        {
+            continue;
+        }
+        for(u32 z = range->min[2]; z <= range->max[2]; z++)
+        {
+            for(u32 y = range->min[1]; y <= range->max[1]; y++)
+            {
+                for(u32 x = range->min[0]; x <= range->max[0]; x++)
+                {
+                    cluster_list[GetClusterIndex(x, y, z)].count++;
+                }
+            }
+        }
+    }
+
+    u32 index_count = 0;
+    clusters->max_cluster_light_count = 0;
+    for(u32 cluster_index = 0; cluster_index < CLUSTER_COUNT; cluster_index++)
+    {
+        cluster_data *cluster = &cluster_list[cluster_index];
+        clusters->max_cluster_light_count = Maximum(clusters->max_cluster_light_count, cluster->count);
+        cluster->offset = index_count;
+        index_count += cluster->count;
+        cluster->count = 0;
+    }
+
+    u32 *index_list = PushArray(transient_arena, Maximum(index_count, 1u), u32);
+    for(u32 light_index = 0; light_index < light_count; light_index++)
+    {
+        if(!visible_list[light_index])
+        {
+            continue;
+        }
+        cluster_range *range = &range_list[light_index];
+        for(u32 z = range->min[2]; z <= range->max[2]; z++)
+        {
+            for(u32 y = range->min[1]; y <= range->max[1]; y++)
+            {
+                for(u32 x = range->min[0]; x <= range->max[0]; x++)
+                {
+                    cluster_data *cluster = &cluster_list[GetClusterIndex(x, y, z)];
+                    index_list[cluster->offset + cluster->count++] = light_index;
+                }
+            }
+        }
+    }
+    clusters->index_count = index_count;
+
+    UploadStorageBuffer(clusters->light_ssbo, &clusters->light_capacity, light_count, sizeof(light_data),
+                        gpu_light_list);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, clusters->cluster_ssbo);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, CLUSTER_COUNT * sizeof(cluster_data), cluster_list);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    UploadStorageBuffer(clusters->index_ssbo, &clusters->index_capacity, index_count, sizeof(u32), index_list);
+}
+
+// NOTE: to test the clusters at scale, lights placed uniformly in bounds with a random color
+void AddRandomLights(std::vector<point_light> *light_list, u32 count, rect3 bounds, f32 intensity, f32 radius)
+{
+    for(u32 i = 0; i < count; i++)
+    {
+        f32 t[3];
+        f32 color[3];
+        for(u32 axis = 0; axis < 3; axis++)
+        {
+            t[axis] = (f32)rand() / (f32)RAND_MAX;
+            color[axis] = intensity * (f32)rand() / (f32)RAND_MAX;
+        }
+        vec3 position = Vec3(bounds.min.x + t[0] * (bounds.max.x - bounds.min.x),
+                             bounds.min.y + t[1] * (bounds.max.y - bounds.min.y),
+                             bounds.min.z + t[2] * (bounds.max.z - bounds.min.z));
+        light_list->push_back({position, Vec3(color[0], color[1], color[2]), radius});
+    }
+}
+
+// NOTE: empty buffers can't be bound, so a buffer with nothing in it yet is skipped
+void BindLightClusters(light_clusters *clusters)
+{
+    if(clusters->light_capacity > 0)
+    {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHT_SSBO_BINDING, clusters->light_ssbo);
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_SSBO_BINDING, clusters->cluster_ssbo);
+    if(clusters->index_capacity > 0)
+    {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHT_INDEX_SSBO_BINDING, clusters->index_ssbo);
+    }
+}
+
+#endif
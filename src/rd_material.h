@@ -0,0 +1,454 @@
+#ifndef RD_MATERIAL_H
+#define RD_MATERIAL_H
+
+#include "glad/glad.h"
+
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "rd_texture.h"
+
+// NOTE, TODO: temporary just to make setting textures easier
+struct pbr_texture_group
+{
+    GLuint albedo;
+    GLuint normal;
+    GLuint metallic;
+    GLuint roughness;
+    GLuint ao;
+};
+
+// NOTE: every material lives in one storage buffer indexed by the material index of
+//       the draw, so the pbr pass never rebinds textures. With ARB_bindless_texture
+//       the buffer holds the texture handles, otherwise the maps are packed in texture
+//       arrays grouped by size and format and the buffer holds array and layer
+#define MATERIAL_SSBO_BINDING 1
+#define MATERIAL_MAP_COUNT 5
+// NOTE: maps are in the order of pbr_texture_group
+#define MATERIAL_ALBEDO_MAP 0
+#define MAX_MATERIAL_ARRAYS 10
+// NOTE: the shadow map is on unit 5, the arrays go right after it
+#define MATERIAL_ARRAY_FIRST_UNIT 6
+
+// NOTE: std430 mirrors of the material_data struct in pbr.fs.glsl
+struct bindless_material_data
+{
+    u64 maps[MATERIAL_MAP_COUNT];
+};
+
+// NOTE: (array index << 16) | layer
+struct array_material_data
+{
+    u32 maps[MATERIAL_MAP_COUNT];
+    u32 pad_[3];
+};
+
+static_assert(sizeof(bindless_material_data) == 40, "bindless_material_data std430 layout error");
+static_assert(sizeof(array_material_data) == 32, "array_material_data std430 layout error");
+
+struct texture_array_key
+{
+    GLint internal_format;
+    GLint width;
+    GLint height;
+};
+
+// NOTE: key of the array the texture is in, it can be smaller than the
+//       source when its top mips were dropped
+struct packed_texture
+{
+    texture_array_key key;
+    u32 location;
+    b32 has_alpha;
+};
+
+// NOTE: not in the loader since it only has the core profile
+typedef GLuint64 (APIENTRYP get_texture_handle_proc)(GLuint texture);
+typedef void (APIENTRYP make_texture_handle_resident_proc)(GLuint64 handle);
+
+struct material_system
+{
+    b32 bindless;
+    GLuint ssbo;
+    std::vector<pbr_texture_group> material_list;
+    // NOTE: used in place of the maps that are still loading
+    pbr_texture_group defaults;
+    b32 is_dirty;
+    u64 texture_upload_count;
+    // NOTE: per material, if the albedo map in the buffer has an alpha channel.
+    //       Only those need the alpha test, updated with the buffer so both agree
+    std::vector<b32> alpha_tested_list;
+
+    get_texture_handle_proc GetTextureHandle;
+    make_texture_handle_resident_proc MakeTextureHandleResident;
+    std::unordered_map<GLuint, GLuint64> handle_table;
+
+    u32 array_count;
+    GLuint array_list[MAX_MATERIAL_ARRAYS];
+    // NOTE: the maps whose source storage was released, by texture id
+    std::unordered_map<GLuint, packed_texture> packed_table;
+};
+
+GLOBAL material_system global_material_system;
+
+inline GLuint GetMaterialMap(pbr_texture_group *group, u32 map_index)
+{
+    GLuint *map_list = (GLuint *)group;
+    GLuint result = map_list[map_index];
+
+    return(result);
+}
+
+// NOTE: bindless is only used when supported and the entry points could be loaded
+void InitializeMaterialSystem(material_system *system, b32 bindless_supported, GLADloadproc load)
+{
+    system->bindless = false;
+    if(bindless_supported)
+    {
+        system->GetTextureHandle = (get_texture_handle_proc)load("glGetTextureHandleARB");
+        system->MakeTextureHandleResident = (make_texture_handle_resident_proc)load("glMakeTextureHandleResidentARB");
+        system->bindless = (system->GetTextureHandle && system->MakeTextureHandleResident);
+    }
+    glGenBuffers(1, &system->ssbo);
+    system->defaults.albedo = LoadTexture(TEXTURE_DEFAULT_WHITE);
+    system->defaults.normal = LoadTexture(TEXTURE_DEFAULT_NORMAL_MAP);
+    system->defaults.metallic = LoadTexture(TEXTURE_DEFAULT_BLACK);
+    system->defaults.roughness = LoadTexture(TEXTURE_DEFAULT_BLACK);
+    system->defaults.ao = LoadTexture(TEXTURE_DEFAULT_WHITE);
+    system->is_dirty = true;
+}
+
+// NOTE: materials with the same maps share the same index
+u32 AddMaterial(material_system *system, pbr_texture_group textures)
+{
+    for(u32 material_index = 0; material_index < system->material_list.size(); material_index++)
+    {
+        if(memcmp(&system->material_list[material_index], &textures, sizeof(textures)) == 0)
+        {
+            return(material_index);
+        }
+    }
+    system->material_list.push_back(textures);
+    system->is_dirty = true;
+
+    return((u32)system->material_list.size() - 1);
+}
+
+// NOTE: a handle makes the texture immutable, so it's only taken once the texture is loaded
+GLuint64 GetMaterialTextureHandle(material_system *system, GLuint texture_id)
+{
+    auto found = system->handle_table.find(texture_id);
+    if(found != system->handle_table.end())
+    {
+        return(found->second);
+    }
+    GLuint64 result = system->GetTextureHandle(texture_id);
+    system->MakeTextureHandleResident(result);
+    system->handle_table.insert({texture_id, result});
+
+    return(result);
+}
+
+INTERNAL b32 HasAlphaChannel(GLuint texture_id)
+{
+    GLint alpha_size = 0;
+    GLBindTexture(GL_TEXTURE_2D, texture_id);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_ALPHA_SIZE, &alpha_size);
+    GLBindTexture(GL_TEXTURE_2D, 0);
+
+    return(alpha_size > 0);
+}
+
+// NOTE: materials added after the last upload are assumed to be alpha tested
+b32 IsMaterialAlphaTested(material_system *system, u32 material_index)
+{
+    b32 result = true;
+    if(material_index < system->alpha_tested_list.size())
+    {
+        result = system->alpha_tested_list[material_index];
+    }
+
+    return(result);
+}
+
+void UploadBindlessMaterials(material_system *system)
+{
+    std::vector<bindless_material_data> gpu_list(system->material_list.size());
+    system->alpha_tested_list.assign(system->material_list.size(), false);
+    for(u32 material_index = 0; material_index < system->material_list.size(); material_index++)
+    {
+        for(u32 map_index = 0; map_index < MATERIAL_MAP_COUNT; map_index++)
+        {
+            GLuint texture_id = GetMaterialMap(&system->material_list[material_index], map_index);
+            if(!IsTextureLoaded(texture_id))
+            {
+                texture_id = GetMaterialMap(&system->defaults, map_index);
+            }
+            gpu_list[material_index].maps[map_index] = GetMaterialTextureHandle(system, texture_id);
+            if(map_index == MATERIAL_ALBEDO_MAP)
+            {
+                system->alpha_tested_list[material_index] = HasAlphaChannel(texture_id);
+            }
+        }
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, system->ssbo);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, gpu_list.size() * sizeof(bindless_material_data),
+                 &gpu_list[0], GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+INTERNAL b32 IsDefaultMaterialMap(material_system *system, GLuint texture_id)
+{
+    b32 result = false;
+    for(u32 map_index = 0; map_index < MATERIAL_MAP_COUNT; map_index++)
+    {
+        result |= (GetMaterialMap(&system->defaults, map_index) == texture_id);
+    }
+
+    return(result);
+}
+
+// NOTE: every texture goes in the first array with the same size and format, the
+//       defaults are packed first so they always get one. When all MAX_MATERIAL_ARRAYS
+//       are taken a texture goes in an array of the same format that matches one of
+//       its smaller mips, the top levels are dropped. If there's none it falls back
+//       to the default map of its slot. Once a loaded map is packed its own storage
+//       is released, later rebuilds copy it from the previous arrays
+void UploadArrayMaterials(material_system *system)
+{
+    u32 old_array_count = system->array_count;
+    GLuint old_array_list[MAX_MATERIAL_ARRAYS];
+    memcpy(old_array_list, system->array_list, sizeof(old_array_list));
+    system->array_count = 0;
+
+    std::vector<GLuint> texture_list;
+    for(u32 map_index = 0; map_index < MATERIAL_MAP_COUNT; map_index++)
+    {
+        texture_list.push_back(GetMaterialMap(&system->defaults, map_index));
+    }
+    for(pbr_texture_group &material : system->material_list)
+    {
+        for(u32 map_index = 0; map_index < MATERIAL_MAP_COUNT; map_index++)
+        {
+            GLuint texture_id = GetMaterialMap(&material, map_index);
+            if(IsTextureLoaded(texture_id))
+            {
+                texture_list.push_back(texture_id);
+            }
+        }
+    }
+
+    texture_array_key key_list[MAX_MATERIAL_ARRAYS];
+    std::vector<GLuint> layer_list[MAX_MATERIAL_ARRAYS];
+    std::unordered_map<GLuint, packed_texture> location_table;
+    // NOTE: mips skipped when copying from the source texture
+    std::unordered_map<GLuint, u32> level_offset_table;
+    u32 dropped_count = 0;
+    for(GLuint texture_id : texture_list)
+    {
+        if(location_table.find(texture_id) != location_table.end())
+        {
+            continue;
+        }
+        packed_texture packed = {};
+        auto found = system->packed_table.find(texture_id);
+        if(found != system->packed_table.end())
+        {
+            packed = found->second;
+        }
+        else
+        {
+            GLint alpha_size = 0;
+            GLBindTexture(GL_TEXTURE_2D, texture_id);
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &packed.key.internal_format);
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &packed.key.width);
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &packed.key.height);
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_ALPHA_SIZE, &alpha_size);
+            packed.has_alpha = (alpha_size > 0);
+        }
+        u32 array_index = 0;
+        while((array_index < system->array_count) &&
+              (memcmp(&key_list[array_index], &packed.key, sizeof(packed.key)) != 0))
+        {
+            array_index++;
+        }
+        u32 level_offset = 0;
+        if(array_index == MAX_MATERIAL_ARRAYS)
+        {
+            for(u32 other_index = 0; other_index < system->array_count; other_index++)
+            {
+                texture_array_key *other = &key_list[other_index];
+                if(other->internal_format != packed.key.internal_format)
+                {
+                    continue;
+                }
+                for(u32 level = 1; level < GetMipCount(packed.key.width, packed.key.height); level++)
+                {
+                    if((GetMipDimension(packed.key.width, level) == (u32)other->width) &&
+                       (GetMipDimension(packed.key.height, level) == (u32)other->height) &&
+                       ((level_offset == 0) || (level < level_offset)))
+                    {
+                        array_index = other_index;
+                        level_offset = level;
+                    }
+                }
+            }
+            if(level_offset == 0)
+            {
+                dropped_count++;
+                continue;
+            }
+            packed.key = key_list[array_index];
+        }
+        if(array_index == system->array_count)
+        {
+            key_list[system->array_count++] = packed.key;
+        }
+        packed.location = (array_index << 16) | (u32)layer_list[array_index].size();
+        location_table.insert({texture_id, packed});
+        level_offset_table.insert({texture_id, level_offset});
+        layer_list[array_index].push_back(texture_id);
+    }
+    GLBindTexture(GL_TEXTURE_2D, 0);
+    if(dropped_count > 0)
+    {
+        std::cout << dropped_count << " material textures don't fit in the " << MAX_MATERIAL_ARRAYS
+                  << " texture arrays, they use the default maps" << std::endl;
+    }
+
+    // NOTE: the textures are all mipmapped down to 1x1, the compressed ones included
+    glGenTextures(system->array_count, system->array_list);
+    for(u32 array_index = 0; array_index < system->array_count; array_index++)
+    {
+        texture_array_key *key = &key_list[array_index];
+        u32 level_count = GetMipCount(key->width, key->height);
+        u32 layer_count = (u32)layer_list[array_index].size();
+        GLBindTexture(GL_TEXTURE_2D_ARRAY, system->array_list[array_index]);
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, level_count, key->internal_format, key->width, key->height, layer_count);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        for(u32 layer = 0; layer < layer_count; layer++)
+        {
+            GLuint texture_id = layer_list[array_index][layer];
+            auto found = system->packed_table.find(texture_id);
+            for(u32 level = 0; level < level_count; level++)
+            {
+                if(found != system->packed_table.end())
+                {
+                    u32 old_location = found->second.location;
+                    glCopyImageSubData(old_array_list[old_location >> 16], GL_TEXTURE_2D_ARRAY, level, 0, 0, old_location & 0xFFFF,
+                                       system->array_list[array_index], GL_TEXTURE_2D_ARRAY, level, 0, 0, layer,
+                                       GetMipDimension(key->width, level), GetMipDimension(key->height, level), 1);
+                }
+                else
+                {
+                    glCopyImageSubData(texture_id, GL_TEXTURE_2D, level + level_offset_table[texture_id], 0, 0, 0,
+                                       system->array_list[array_index], GL_TEXTURE_2D_ARRAY, level, 0, 0, layer,
+                                       GetMipDimension(key->width, level), GetMipDimension(key->height, level), 1);
+                }
+            }
+        }
+    }
+    GLBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    GLDeleteTextures(old_array_count, old_array_list);
+
+    // NOTE: the name is kept so it can't be handed out again while the materials
+    //       refer to it, respecifying every level as empty frees the storage. The
+    //       defaults are also bound directly, they're a single texel and keep theirs.
+    //       Released textures are dropped from the LoadTexture cache, loading the same
+    //       file again makes a new texture instead of returning the empty one
+    std::unordered_map<GLuint, packed_texture> packed_table;
+    std::unordered_set<GLuint> released_set;
+    for(auto &entry : location_table)
+    {
+        if(!IsTextureLoaded(entry.first) || IsDefaultMaterialMap(system, entry.first))
+        {
+            continue;
+        }
+        if(system->packed_table.find(entry.first) == system->packed_table.end())
+        {
+            released_set.insert(entry.first);
+            GLint width = 0;
+            GLint height = 0;
+            GLBindTexture(GL_TEXTURE_2D, entry.first);
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+            for(u32 level = 0; level < GetMipCount(width, height); level++)
+            {
+                glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+            }
+        }
+        packed_table.insert(entry);
+    }
+    GLBindTexture(GL_TEXTURE_2D, 0);
+    system->packed_table.swap(packed_table);
+    ForgetLoadedTextures(released_set);
+
+    std::vector<array_material_data> gpu_list(system->material_list.size());
+    system->alpha_tested_list.assign(system->material_list.size(), false);
+    for(u32 material_index = 0; material_index < system->material_list.size(); material_index++)
+    {
+        for(u32 map_index = 0; map_index < MATERIAL_MAP_COUNT; map_index++)
+        {
+            auto found = location_table.find(GetMaterialMap(&system->material_list[material_index], map_index));
+            if(found == location_table.end())
+            {
+                found = location_table.find(GetMaterialMap(&system->defaults, map_index));
+            }
+            gpu_list[material_index].maps[map_index] = found->second.location;
+            if(map_index == MATERIAL_ALBEDO_MAP)
+            {
+                system->alpha_tested_list[material_index] = found->second.has_alpha;
+            }
+        }
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, system->ssbo);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, gpu_list.size() * sizeof(array_material_data),
+                 &gpu_list[0], GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+// NOTE: call once per frame after ProcessLoadedTextures, the materials are rebuilt
+//       when one is added or a map finishes loading. Packing the arrays copies every
+//       map so while textures are loading it's only done the first time
+void UpdateMaterials(material_system *system, u32 pending_texture_count)
+{
+    if(system->texture_upload_count != global_texture_loader.upload_count)
+    {
+        system->texture_upload_count = global_texture_loader.upload_count;
+        system->is_dirty = true;
+    }
+    if(!system->is_dirty || system->material_list.empty())
+    {
+        return;
+    }
+
+    if(system->bindless)
+    {
+        UploadBindlessMaterials(system);
+        system->is_dirty = false;
+    }
+    else if((pending_texture_count == 0) || (system->array_count == 0))
+    {
+        UploadArrayMaterials(system);
+        system->is_dirty = (pending_texture_count > 0);
+    }
+}
+
+void BindMaterials(material_system *system)
+{
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MATERIAL_SSBO_BINDING, system->ssbo);
+    if(!system->bindless)
+    {
+        for(u32 array_index = 0; array_index < system->array_count; array_index++)
+        {
+            GLActiveTexture(GL_TEXTURE0 + MATERIAL_ARRAY_FIRST_UNIT + array_index);
+            GLBindTexture(GL_TEXTURE_2D_ARRAY, system->array_list[array_index]);
+        }
+    }
+}
+
+#endif
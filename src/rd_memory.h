@@ -0,0 +1,146 @@
+#ifndef RD_MEMORY_H
+#define RD_MEMORY_H
+
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+
+// NOTE: linear allocator, everything pushed on an arena is freed at once
+//       by resetting it (or by ending a temporary memory block)
+struct memory_arena
+{
+    u8 *base;
+    u64 size;
+    u64 used;
+    u32 temporary_count;
+};
+
+struct temporary_memory
+{
+    memory_arena *arena;
+    u64 used;
+};
+
+// NOTE: permanent lives for the whole run, scratch is reset after loading
+//       each asset, transient is reset at the beginning of every frame
+struct game_memory
+{
+    u64 storage_size;
+    void *storage;
+
+    memory_arena permanent_arena;
+    memory_arena scratch_arena;
+    memory_arena transient_arena;
+};
+
+#define PERMANENT_STORAGE_SIZE Megabytes(512)
+#define SCRATCH_ARENA_SIZE Megabytes(256)
+#define TRANSIENT_ARENA_SIZE Megabytes(64)
+#define DEFAULT_ARENA_ALIGNMENT 16
+
+inline void InitializeArena(memory_arena *arena, u64 size, void *base)
+{
+    arena->base = (u8 *)base;
+    arena->size = size;
+    arena->used = 0;
+    arena->temporary_count = 0;
+}
+
+inline u64 GetAlignmentOffset(memory_arena *arena, u64 alignment)
+{
+    u64 result = 0;
+    u64 pointer = (u64)(arena->base + arena->used);
+    u64 mask = alignment - 1;
+    if(pointer & mask)
+    {
+        result = alignment - (pointer & mask);
+    }
+
+    return(result);
+}
+
+#define PushStruct(arena, type) (type *)PushSize_(arena, sizeof(type))
+#define PushArray(arena, count, type) (type *)PushSize_(arena, (count) * sizeof(type))
+#define PushSize(arena, size) PushSize_(arena, size)
+inline void *PushSize_(memory_arena *arena, u64 size, u64 alignment = DEFAULT_ARENA_ALIGNMENT)
+{
+    u64 offset = GetAlignmentOffset(arena, alignment);
+    u64 total_size = size + offset;
+    // NOTE: Assert only prints, so an overflow stops here instead of handing
+    //       NULL to callers that never check it
+    Assert((arena->used + total_size) <= arena->size);
+    if((arena->used + total_size) > arena->size)
+    {
+        printf("arena overflow: %llu bytes pushed with %llu of %llu used\n", (unsigned long long)total_size,
+               (unsigned long long)arena->used, (unsigned long long)arena->size);
+        exit(1);
+    }
+
+    void *result = arena->base + arena->used + offset;
+    arena->used += total_size;
+
+    return(result);
+}
+
+inline void SubArena(memory_arena *result, memory_arena *arena, u64 size, u64 alignment = DEFAULT_ARENA_ALIGNMENT)
+{
+    result->size = size;
+    result->base = (u8 *)PushSize_(arena, size, alignment);
+    result->used = 0;
+    result->temporary_count = 0;
+}
+
+inline void ResetArena(memory_arena *arena)
+{
+    Assert(arena->temporary_count == 0);
+    arena->used = 0;
+}
+
+inline temporary_memory BeginTemporaryMemory(memory_arena *arena)
+{
+    temporary_memory result;
+    result.arena = arena;
+    result.used = arena->used;
+    arena->temporary_count++;
+
+    return(result);
+}
+
+inline void EndTemporaryMemory(temporary_memory temp)
+{
+    memory_arena *arena = temp.arena;
+    Assert(arena->used >= temp.used);
+    Assert(arena->temporary_count > 0);
+    arena->used = temp.used;
+    arena->temporary_count--;
+}
+
+// NOTE: copies a null terminated string in the arena
+inline char *PushString(memory_arena *arena, const char *source)
+{
+    u64 length = strlen(source);
+    char *result = (char *)PushSize_(arena, length + 1, 1);
+    memcpy(result, source, length + 1);
+
+    return(result);
+}
+
+// NOTE: the whole storage is allocated once at startup, the scratch and
+//       transient arenas are carved out of the permanent one
+b32 InitializeGameMemory(game_memory *memory)
+{
+    memory->storage_size = PERMANENT_STORAGE_SIZE;
+    memory->storage = malloc(memory->storage_size);
+    if(!memory->storage)
+    {
+        return(false);
+    }
+
+    InitializeArena(&memory->permanent_arena, memory->storage_size, memory->storage);
+    SubArena(&memory->scratch_arena, &memory->permanent_arena, SCRATCH_ARENA_SIZE);
+    SubArena(&memory->transient_arena, &memory->permanent_arena, TRANSIENT_ARENA_SIZE);
+
+    return(true);
+}
+
+#endif
@@ -13,74 +13,12 @@
 #include <unordered_map>
 #include <iostream>
 
-void ReplaceAll(std::string& input, std::string &old_char, std::string &new_char)
-{
-    size_t pos = 0; 
-    while ((pos = input.find(old_char, pos)) != std::string::npos) 
-    {
-        input.replace(pos, old_char.size(), new_char); 
-        pos += new_char.size();
-    }
-}
-// NOTE: speeding up texture loading momentarily
-// TODO: texture system/db, separate handling of gltf textures,
-//       specify flip for each texture
-GLOBAL std::unordered_map<std::string, GLuint> global_loaded_textures;
-GLuint LoadTexture(std::string filename)
-{
-    // NOTE: just a temporary fix to load some filenames
-    // TODO: custom string library
-    std::string old_char = "\\";
-    std::string new_char = "/";
-    ReplaceAll(filename, old_char, new_char);
-    if (global_loaded_textures.find(filename) != global_loaded_textures.end()) {
-        return(global_loaded_textures.at(filename));
-    }
-    GLuint texture_id;
-    glGenTextures(1, &texture_id);
-    i32 texture_width, texture_height, channel_count;
-    stbi_set_flip_vertically_on_load(true);
-
-    std::string path = ASSETS_FOLDER + filename;
-    // TODO: add this print in a possible debug build
-    //std::cout << "loading texture: " << path << std::endl;
-    u8 *data = stbi_load(path.c_str(), &texture_width, &texture_height, &channel_count, 0);
-    if(data)
-    {
-        GLenum format;
-        if(channel_count == 1)
-        {
-            format = GL_RED;
-        }
-        else if(channel_count == 3)
-        {
-            format = GL_RGB;
-        }
-        else if(channel_count == 4)
-        {
-            format = GL_RGBA;
-        }
-        glBindTexture(GL_TEXTURE_2D, texture_id);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, texture_width, texture_height, 
-                     0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glBindTexture(GL_TEXTURE_2D, 0);
-    }
-    else
-    {
-        Assert(!"failed to load texture");
-    }
-
-    stbi_image_free(data);
-    stbi_set_flip_vertically_on_load(false);
-    global_loaded_textures.insert({filename, texture_id});
+#include "fcntl.h"
+#include "sys/mman.h"
+#include "sys/stat.h"
+#include "unistd.h"
 
-    return(texture_id);
-}
+#include "rd_material.h"
 
 struct vertex_data
 {
@@ -89,16 +27,6 @@ struct vertex_data
     vec2 tex_coords;
 };
 
-// NOTE, TODO: temporary just to make setting textures easier
-struct pbr_texture_group
-{
-    GLuint albedo;
-    GLuint normal;
-    GLuint metallic;
-    GLuint roughness;
-    GLuint ao;
-};
-
 struct mesh_data
 {
     GLuint vao;
@@ -106,69 +34,203 @@ struct mesh_data
     GLuint ebo;
     u32 index_count;
     u32 vertex_count;
-    pbr_texture_group textures;
+    // NOTE: position in the mesh buffer, both 0 for meshes with their own buffers
+    u32 first_index;
+    i32 base_vertex;
+    // NOTE: index in global_material_system
+    u32 material_index;
+    // NOTE: object space bounding box, used for culling
+    rect3 bounds;
 };
 
-// NOTE: assuming albedo=0, normal=1, metallic=2, roughness=3, ao=4
-void SetShaderPBRTextures(pbr_texture_group *pbr)
+// NOTE: positions are read with a stride so this works for any vertex layout
+//       that starts with a vec3 position
+rect3 GetVertexBounds(void *vertex_list, u32 vertex_count, u32 stride)
 {
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, pbr->albedo);
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, pbr->normal);
-    glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_2D, pbr->metallic);
-    glActiveTexture(GL_TEXTURE3);
-    glBindTexture(GL_TEXTURE_2D, pbr->roughness);
-    glActiveTexture(GL_TEXTURE4);
-    glBindTexture(GL_TEXTURE_2D, pbr->ao);
+    rect3 result = Rect3(Vec3(0.0f), Vec3(0.0f));
+    if(vertex_count > 0)
+    {
+        result = Rect3(Vec3(FLT_MAX), Vec3(-FLT_MAX));
+        u8 *vertex = (u8 *)vertex_list;
+        for(u32 vertex_index = 0; vertex_index < vertex_count; vertex_index++)
+        {
+            vec3 position = *(vec3 *)vertex;
+            result.min = Vec3(Minimum(result.min.x, position.x),
+                              Minimum(result.min.y, position.y),
+                              Minimum(result.min.z, position.z));
+            result.max = Vec3(Maximum(result.max.x, position.x),
+                              Maximum(result.max.y, position.y),
+                              Maximum(result.max.z, position.z));
+            vertex += stride;
+        }
+    }
+
+    return(result);
 }
-void SetShaderPBRTextures(mesh_data *mesh)
+
+// NOTE: every textured mesh is suballocated from one vertex and one index buffer
+//       that share a single vao, so a whole pass can be submitted with a few
+//       glMultiDrawElementsIndirect calls. The per instance attribute reads from
+//       the instance buffer of the pass, bound with BindMeshBufferInstances
+#define MESH_BUFFER_VERTEX_CAPACITY (1024 * 1024)
+#define MESH_BUFFER_INDEX_CAPACITY (4 * 1024 * 1024)
+#define MESH_BUFFER_VERTEX_BINDING 0
+#define MESH_BUFFER_INSTANCE_BINDING 1
+#define MESH_BUFFER_INSTANCE_ATTRIBUTE 3
+struct mesh_buffer
 {
-    SetShaderPBRTextures(&mesh->textures);
-}
+    GLuint vao;
+    GLuint vbo;
+    GLuint ebo;
+    u32 vertex_capacity;
+    u32 vertex_count;
+    u32 index_capacity;
+    u32 index_count;
+};
 
-mesh_data MeshData(u32 vertex_count, void* vertex_list, u32 index_count = 0, void* index_list = NULL)
+GLOBAL mesh_buffer global_mesh_buffer;
+
+void InitializeMeshBuffer(mesh_buffer *buffer, u32 vertex_capacity, u32 index_capacity)
 {
-    mesh_data m;
-    m.index_count = index_count;
-    m.vertex_count = vertex_count;
-    glGenVertexArrays(1, &m.vao);
-    glGenBuffers(1, &m.vbo);
-    glBindVertexArray(m.vao);
-    glBindBuffer(GL_ARRAY_BUFFER, m.vbo);
-    glBufferData(GL_ARRAY_BUFFER, vertex_count * sizeof(vertex_data), vertex_list, GL_STATIC_DRAW);
+    buffer->vertex_capacity = vertex_capacity;
+    buffer->index_capacity = index_capacity;
+    buffer->vertex_count = 0;
+    buffer->index_count = 0;
+    glGenVertexArrays(1, &buffer->vao);
+    glGenBuffers(1, &buffer->vbo);
+    glGenBuffers(1, &buffer->ebo);
+    GLBindVertexArray(buffer->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer->vbo);
+    glBufferData(GL_ARRAY_BUFFER, (u64)vertex_capacity * sizeof(vertex_data), NULL, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer->ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, (u64)index_capacity * sizeof(u32), NULL, GL_STATIC_DRAW);
+
     glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vertex_data), (void *)0);
+    glVertexAttribFormat(0, 3, GL_FLOAT, GL_FALSE, offsetof(vertex_data, position));
+    glVertexAttribBinding(0, MESH_BUFFER_VERTEX_BINDING);
     glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(vertex_data), (void *)offsetof(vertex_data, normal));
+    glVertexAttribFormat(1, 3, GL_FLOAT, GL_FALSE, offsetof(vertex_data, normal));
+    glVertexAttribBinding(1, MESH_BUFFER_VERTEX_BINDING);
     glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(vertex_data), (void *)offsetof(vertex_data, tex_coords));
-    
-    if(index_count > 0)
+    glVertexAttribFormat(2, 2, GL_FLOAT, GL_FALSE, offsetof(vertex_data, tex_coords));
+    glVertexAttribBinding(2, MESH_BUFFER_VERTEX_BINDING);
+    glBindVertexBuffer(MESH_BUFFER_VERTEX_BINDING, buffer->vbo, 0, sizeof(vertex_data));
+
+    // NOTE: uvec2, x is the object index and y a pass specific value, with base_instance
+    //       in the indirect command every draw reads its own entries
+    glEnableVertexAttribArray(MESH_BUFFER_INSTANCE_ATTRIBUTE);
+    glVertexAttribIFormat(MESH_BUFFER_INSTANCE_ATTRIBUTE, 2, GL_UNSIGNED_INT, 0);
+    glVertexAttribBinding(MESH_BUFFER_INSTANCE_ATTRIBUTE, MESH_BUFFER_INSTANCE_BINDING);
+    glVertexBindingDivisor(MESH_BUFFER_INSTANCE_BINDING, 1);
+    GLBindVertexArray(0);
+}
+
+// NOTE: the contents are copied on the gpu, the old buffer is deleted
+GLuint ResizeBuffer(GLuint buffer, u64 old_size, u64 new_size)
+{
+    GLuint result;
+    glGenBuffers(1, &result);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, result);
+    glBufferData(GL_COPY_WRITE_BUFFER, new_size, NULL, GL_STATIC_DRAW);
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, old_size);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    glDeleteBuffers(1, &buffer);
+
+    return(result);
+}
+
+// NOTE: grows by doubling, only happens while loading
+void ReserveMeshBuffer(mesh_buffer *buffer, u32 vertex_count, u32 index_count)
+{
+    if(buffer->vertex_count + vertex_count > buffer->vertex_capacity)
     {
-        glGenBuffers(1, &m.ebo);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m.ebo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_count * sizeof(u32), index_list, GL_STATIC_DRAW);
+        u32 new_capacity = Maximum(buffer->vertex_capacity * 2, buffer->vertex_count + vertex_count);
+        buffer->vbo = ResizeBuffer(buffer->vbo, (u64)buffer->vertex_count * sizeof(vertex_data),
+                                   (u64)new_capacity * sizeof(vertex_data));
+        buffer->vertex_capacity = new_capacity;
+        GLBindVertexArray(buffer->vao);
+        glBindVertexBuffer(MESH_BUFFER_VERTEX_BINDING, buffer->vbo, 0, sizeof(vertex_data));
+        GLBindVertexArray(0);
     }
+    if(buffer->index_count + index_count > buffer->index_capacity)
+    {
+        u32 new_capacity = Maximum(buffer->index_capacity * 2, buffer->index_count + index_count);
+        buffer->ebo = ResizeBuffer(buffer->ebo, (u64)buffer->index_count * sizeof(u32),
+                                   (u64)new_capacity * sizeof(u32));
+        buffer->index_capacity = new_capacity;
+        GLBindVertexArray(buffer->vao);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer->ebo);
+        GLBindVertexArray(0);
+    }
+}
+
+// NOTE: the buffer with the per instance uvec2s used by the next draws
+void BindMeshBufferInstances(mesh_buffer *buffer, GLuint instance_buffer)
+{
+    GLBindVertexArray(buffer->vao);
+    glBindVertexBuffer(MESH_BUFFER_INSTANCE_BINDING, instance_buffer, 0, 2 * sizeof(u32));
+}
+
+// NOTE: meshes without indices get a sequential index list so
+//       every mesh in the buffer can be drawn with the same command
+mesh_data MeshData(u32 vertex_count, void* vertex_list, u32 index_count = 0, void* index_list = NULL)
+{
+    mesh_buffer *buffer = &global_mesh_buffer;
+    if(!buffer->vao)
+    {
+        InitializeMeshBuffer(buffer, MESH_BUFFER_VERTEX_CAPACITY, MESH_BUFFER_INDEX_CAPACITY);
+    }
+
+    std::vector<u32> sequential_index_list;
+    if(index_count == 0)
+    {
+        sequential_index_list.resize(vertex_count);
+        for(u32 i = 0; i < vertex_count; i++)
+        {
+            sequential_index_list[i] = i;
+        }
+        index_count = vertex_count;
+        index_list = &sequential_index_list[0];
+    }
+    ReserveMeshBuffer(buffer, vertex_count, index_count);
+
+    mesh_data m = {};
+    m.vao = buffer->vao;
+    m.index_count = index_count;
+    m.vertex_count = vertex_count;
+    m.first_index = buffer->index_count;
+    m.base_vertex = (i32)buffer->vertex_count;
+    m.bounds = GetVertexBounds(vertex_list, vertex_count, sizeof(vertex_data));
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer->vbo);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, (u64)buffer->vertex_count * sizeof(vertex_data),
+                    (u64)vertex_count * sizeof(vertex_data), vertex_list);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer->ebo);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, (u64)buffer->index_count * sizeof(u32),
+                    (u64)index_count * sizeof(u32), index_list);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    buffer->vertex_count += vertex_count;
+    buffer->index_count += index_count;
 
-    glBindVertexArray(0);
     return(m); 
 }
 
 mesh_data MeshDataUntextured(u32 vertex_count, void* vertex_list, u32 index_count = 0, void* index_list = NULL)
 {
-    mesh_data m;
+    mesh_data m = {};
     m.index_count = index_count;
     m.vertex_count = vertex_count;
+    m.bounds = GetVertexBounds(vertex_list, vertex_count, sizeof(vec3));
     glGenVertexArrays(1, &m.vao);
     glGenBuffers(1, &m.vbo);
-    glBindVertexArray(m.vao);
+    GLBindVertexArray(m.vao);
     glBindBuffer(GL_ARRAY_BUFFER, m.vbo);
     glBufferData(GL_ARRAY_BUFFER, vertex_count * sizeof(vec3), vertex_list, GL_STATIC_DRAW);
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3), (void *)0);
-    glBindVertexArray(0);
+    GLBindVertexArray(0);
 
     if(index_count > 0)
     {
@@ -177,17 +239,17 @@ mesh_data MeshDataUntextured(u32 vertex_count, void* vertex_list, u32 index_coun
         glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_count * sizeof(u32), index_list, GL_STATIC_DRAW);
     }
 
-    glBindVertexArray(0);
+    GLBindVertexArray(0);
     return(m); 
 }
 
 void RenderMesh(mesh_data *mesh)
 {
-    SetShaderPBRTextures(mesh);
-    glBindVertexArray(mesh->vao);
+    GLBindVertexArray(mesh->vao);
     if(mesh->index_count > 0)
     {
-        glDrawElements(GL_TRIANGLES, mesh->index_count, GL_UNSIGNED_INT, 0);
+        glDrawElementsBaseVertex(GL_TRIANGLES, mesh->index_count, GL_UNSIGNED_INT,
+                                 (void *)((u64)mesh->first_index * sizeof(u32)), mesh->base_vertex);
     }
     else
     {
@@ -195,22 +257,267 @@ void RenderMesh(mesh_data *mesh)
     }
 }
 
-void ProcessNode(std::vector<mesh_data> &mesh_list, std::string directory, aiNode *node, const aiScene *scene)
+// NOTE: texture names as passed to LoadTexture, stored in the mesh cache
+//       so warm starts don't need assimp to resolve the materials
+#define MESH_TEXTURE_PATH_LENGTH 256
+struct mesh_texture_paths
+{
+    char albedo[MESH_TEXTURE_PATH_LENGTH];
+    char normal[MESH_TEXTURE_PATH_LENGTH];
+    char metallic[MESH_TEXTURE_PATH_LENGTH];
+    char roughness[MESH_TEXTURE_PATH_LENGTH];
+    char ao[MESH_TEXTURE_PATH_LENGTH];
+};
+
+void SetTexturePath(char *dest, std::string path)
+{
+    Assert(path.size() < MESH_TEXTURE_PATH_LENGTH);
+    strncpy(dest, path.c_str(), MESH_TEXTURE_PATH_LENGTH - 1);
+    dest[MESH_TEXTURE_PATH_LENGTH - 1] = 0;
+}
+
+// NOTE: picks the first texture of the given types, or the default texture if none is present
+void GetMaterialTexturePath(char *dest, aiMaterial *mat, std::string &directory,
+                            aiTextureType type, aiTextureType fallback_type, const char *default_texture)
+{
+    aiString filename;
+    if(mat->GetTextureCount(type) > 0)
+    {
+        mat->GetTexture(type, 0, &filename);
+        SetTexturePath(dest, directory + '/' + filename.C_Str());
+    }
+    else if(mat->GetTextureCount(fallback_type) > 0)
+    {
+        mat->GetTexture(fallback_type, 0, &filename);
+        SetTexturePath(dest, directory + '/' + filename.C_Str());
+    }
+    else
+    {
+        SetTexturePath(dest, default_texture);
+    }
+}
+
+void GetMaterialTexturePaths(mesh_texture_paths *paths, aiMaterial *mat, std::string &directory)
+{
+    // TODO: debug missing diffuse, at the moment it falls back to the directory itself
+    GetMaterialTexturePath(paths->albedo, mat, directory, aiTextureType_DIFFUSE, aiTextureType_BASE_COLOR,
+                           (directory + '/').c_str());
+    GetMaterialTexturePath(paths->normal, mat, directory, aiTextureType_NORMALS, aiTextureType_HEIGHT,
+                           TEXTURE_DEFAULT_NORMAL_MAP);
+    GetMaterialTexturePath(paths->metallic, mat, directory, aiTextureType_METALNESS, aiTextureType_METALNESS,
+                           TEXTURE_DEFAULT_BLACK);
+    GetMaterialTexturePath(paths->roughness, mat, directory, aiTextureType_DIFFUSE_ROUGHNESS, 
+                           aiTextureType_DIFFUSE_ROUGHNESS, TEXTURE_DEFAULT_BLACK);
+    GetMaterialTexturePath(paths->ao, mat, directory, aiTextureType_AMBIENT_OCCLUSION, aiTextureType_AMBIENT,
+                           TEXTURE_DEFAULT_WHITE);
+}
+
+pbr_texture_group LoadTextureGroup(mesh_texture_paths *paths)
+{
+    pbr_texture_group result;
+    result.albedo = LoadTexture(paths->albedo, TEXTURE_DEFAULT_WHITE);
+    result.normal = LoadTexture(paths->normal, TEXTURE_DEFAULT_NORMAL_MAP);
+    result.metallic = LoadTexture(paths->metallic, TEXTURE_DEFAULT_BLACK);
+    result.roughness = LoadTexture(paths->roughness, TEXTURE_DEFAULT_BLACK);
+    result.ao = LoadTexture(paths->ao, TEXTURE_DEFAULT_WHITE);
+
+    return(result);
+}
+
+// NOTE: binary cache of a loaded model, written next to the source file the first time
+//       it's loaded. Layout: header, then the vertex and index lists of every mesh
+//       (16 byte aligned), then the mesh table at header.mesh_table_offset.
+//       Bump MESH_CACHE_VERSION whenever vertex_data or the layout changes
+#define MESH_CACHE_EXTENSION ".rdcache"
+#define MESH_CACHE_MAGIC 0x434d4452 // "RDMC"
+#define MESH_CACHE_VERSION 1
+#define MESH_CACHE_ALIGNMENT 16
+
+struct mesh_cache_header
+{
+    u32 magic;
+    u32 version;
+    u32 vertex_size;
+    u32 mesh_count;
+    // NOTE: size and modification time of the source file, the cache is rebuilt if they change
+    u64 source_size;
+    i64 source_mtime;
+    u64 mesh_table_offset;
+};
+
+struct mesh_cache_entry
+{
+    u32 vertex_count;
+    u32 index_count;
+    u64 vertex_offset;
+    u64 index_offset;
+    mesh_texture_paths textures;
+};
+
+struct mesh_cache_writer
+{
+    FILE *file;
+    u64 offset;
+    std::vector<mesh_cache_entry> entry_list;
+};
+
+u64 WriteCacheBlock(mesh_cache_writer *writer, void *data, u64 size)
+{
+    static u8 padding[MESH_CACHE_ALIGNMENT] = {};
+    u64 padding_size = (MESH_CACHE_ALIGNMENT - (writer->offset % MESH_CACHE_ALIGNMENT)) % MESH_CACHE_ALIGNMENT;
+    fwrite(padding, 1, padding_size, writer->file);
+    writer->offset += padding_size;
+
+    u64 result = writer->offset;
+    fwrite(data, 1, size, writer->file);
+    writer->offset += size;
+
+    return(result);
+}
+
+b32 BeginMeshCache(mesh_cache_writer *writer, std::string temp_path)
+{
+    writer->file = fopen(temp_path.c_str(), "wb");
+    if(!writer->file)
+    {
+        return(false);
+    }
+    // NOTE: placeholder, the real header is written by EndMeshCache
+    mesh_cache_header header = {};
+    fwrite(&header, sizeof(header), 1, writer->file);
+    writer->offset = sizeof(header);
+    writer->entry_list.clear();
+
+    return(true);
+}
+
+void AddMeshToCache(mesh_cache_writer *writer, vertex_data *vertex_list, u32 vertex_count,
+                    u32 *index_list, u32 index_count, mesh_texture_paths *textures)
+{
+    mesh_cache_entry entry = {};
+    entry.vertex_count = vertex_count;
+    entry.index_count = index_count;
+    entry.vertex_offset = WriteCacheBlock(writer, vertex_list, (u64)vertex_count * sizeof(vertex_data));
+    entry.index_offset = WriteCacheBlock(writer, index_list, (u64)index_count * sizeof(u32));
+    entry.textures = *textures;
+    writer->entry_list.push_back(entry);
+}
+
+// NOTE: the cache is written to a temporary file and renamed at the end,
+//       so an interrupted load never leaves a truncated cache behind
+void EndMeshCache(mesh_cache_writer *writer, std::string temp_path, std::string cache_path, std::string source_path)
+{
+    mesh_cache_header header = {};
+    header.magic = MESH_CACHE_MAGIC;
+    header.version = MESH_CACHE_VERSION;
+    header.vertex_size = sizeof(vertex_data);
+    header.mesh_count = (u32)writer->entry_list.size();
+    GetFileInfo(source_path.c_str(), &header.source_size, &header.source_mtime);
+    if(header.mesh_count > 0)
+    {
+        header.mesh_table_offset = WriteCacheBlock(writer, &writer->entry_list[0],
+                                                   header.mesh_count * sizeof(mesh_cache_entry));
+    }
+
+    fseek(writer->file, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, writer->file);
+    b32 ok = (ferror(writer->file) == 0);
+    fclose(writer->file);
+    writer->file = NULL;
+
+    if(ok)
+    {
+        rename(temp_path.c_str(), cache_path.c_str());
+    }
+    else
+    {
+        remove(temp_path.c_str());
+    }
+}
+
+// NOTE: maps the cache file and uploads the vertex and index lists straight from it,
+//       returns false if there is no cache or it's stale so the model is loaded with assimp
+b32 LoadModelFromCache(std::vector<mesh_data> &mesh_list, std::string cache_path, std::string source_path)
+{
+    i32 fd = open(cache_path.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        return(false);
+    }
+    struct stat info;
+    if((fstat(fd, &info) != 0) || ((u64)info.st_size < sizeof(mesh_cache_header)))
+    {
+        close(fd);
+        return(false);
+    }
+    u64 file_size = (u64)info.st_size;
+    void *mapping = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED)
+    {
+        return(false);
+    }
+
+    u8 *base = (u8 *)mapping;
+    mesh_cache_header *header = (mesh_cache_header *)base;
+    u64 source_size = 0;
+    i64 source_mtime = 0;
+    b32 valid = ((header->magic == MESH_CACHE_MAGIC) &&
+                 (header->version == MESH_CACHE_VERSION) &&
+                 (header->vertex_size == sizeof(vertex_data)) &&
+                 GetFileInfo(source_path.c_str(), &source_size, &source_mtime) &&
+                 (header->source_size == source_size) &&
+                 (header->source_mtime == source_mtime) &&
+                 (header->mesh_table_offset + (u64)header->mesh_count * sizeof(mesh_cache_entry) <= file_size));
+    mesh_cache_entry *entry_list = (mesh_cache_entry *)(base + header->mesh_table_offset);
+    // NOTE: every entry is checked before anything is uploaded, so a corrupted cache
+    //       leaves nothing behind in the mesh list, the mesh buffer or the materials
+    //       and the caller imports the model again, which rewrites the cache
+    for(u32 entry_index = 0; valid && (entry_index < header->mesh_count); entry_index++)
+    {
+        mesh_cache_entry *entry = &entry_list[entry_index];
+        if((entry->vertex_offset + (u64)entry->vertex_count * sizeof(vertex_data) > file_size) ||
+           (entry->index_offset + (u64)entry->index_count * sizeof(u32) > file_size))
+        {
+            std::cout << "corrupted mesh cache " << cache_path << ", reimporting the model" << std::endl;
+            valid = false;
+        }
+    }
+    if(valid)
+    {
+        for(u32 entry_index = 0; entry_index < header->mesh_count; entry_index++)
+        {
+            mesh_cache_entry *entry = &entry_list[entry_index];
+            mesh_data m = MeshData(entry->vertex_count, base + entry->vertex_offset,
+                                   entry->index_count, base + entry->index_offset);
+            m.material_index = AddMaterial(&global_material_system, LoadTextureGroup(&entry->textures));
+            mesh_list.push_back(m);
+        }
+    }
+    munmap(mapping, file_size);
+
+    return(valid);
+}
+
+// NOTE: vertex and index lists only live in the scratch arena until they are
+//       uploaded to the GPU (and written to the cache), the arena is rolled back after every mesh
+void ProcessNode(std::vector<mesh_data> &mesh_list, std::string directory, aiNode *node, const aiScene *scene,
+                 memory_arena *scratch_arena, mesh_cache_writer *cache)
 {
     for(u32 mesh_index = 0; mesh_index < node->mNumMeshes; mesh_index++)
     {
         aiMesh *mesh = scene->mMeshes[node->mMeshes[mesh_index]];
+        temporary_memory mesh_memory = BeginTemporaryMemory(scratch_arena);
 
         u32 vertex_count = mesh->mNumVertices;
-        // TODO, MEMORY
-        vertex_data *vertex_list = (vertex_data*)malloc(sizeof(vertex_data) * vertex_count);
+        vertex_data *vertex_list = PushArray(scratch_arena, vertex_count, vertex_data);
         u32 face_count = mesh->mNumFaces;
         u32 index_count = 0;
         for(u32 face_index = 0; face_index < face_count; face_index++)
         {
             index_count += mesh->mFaces[face_index].mNumIndices;
         } 
-        u32 *index_list = (u32*)malloc(sizeof(u32) * index_count);
+        u32 *index_list = PushArray(scratch_arena, index_count, u32);
 
         for(u32 vertex_index = 0; vertex_index < vertex_count; vertex_index++)
         {
@@ -246,96 +553,37 @@ void ProcessNode(std::vector<mesh_data> &mesh_list, std::string directory, aiNod
             }
         }
 
-        mesh_data m = MeshData(vertex_count, &vertex_list[0], index_count, &index_list[0]);
         // TODO: support meshes with multiple textures
-        if(mesh->mMaterialIndex >= 0)
-        {
-            aiMaterial *mat = scene->mMaterials[mesh->mMaterialIndex];
-            aiString filename;
-            if(mat->GetTextureCount(aiTextureType_DIFFUSE) > 0)
-            {
-                mat->GetTexture(aiTextureType_DIFFUSE, 0, &filename);
-            }
-            else if(mat->GetTextureCount(aiTextureType_BASE_COLOR) > 0)
-            {
-                mat->GetTexture(aiTextureType_BASE_COLOR, 0, &filename);
-            }
-            else
-            {
-                Assert("missing diffuse");
-                // TODO: debug
-            }
-            std::string path = directory + '/' + filename.C_Str();
-            m.textures.albedo = LoadTexture(path);
-
-            if(mat->GetTextureCount(aiTextureType_NORMALS) > 0)
-            {
-                mat->GetTexture(aiTextureType_NORMALS, 0, &filename);
-                path = directory + '/' + filename.C_Str();
-                m.textures.normal = LoadTexture(path);
-            }
-            else if(mat->GetTextureCount(aiTextureType_HEIGHT) > 0)
-            {
-                mat->GetTexture(aiTextureType_HEIGHT, 0, &filename);
-                path = directory + '/' + filename.C_Str();
-                m.textures.normal = LoadTexture(path);
-            }
-            else
-            {
-                m.textures.normal = LoadTexture(TEXTURE_DEFAULT_NORMAL_MAP);
-            }
+        mesh_texture_paths *texture_paths = PushStruct(scratch_arena, mesh_texture_paths);
+        GetMaterialTexturePaths(texture_paths, scene->mMaterials[mesh->mMaterialIndex], directory);
 
-            if(mat->GetTextureCount(aiTextureType_METALNESS) > 0)
-            {
-                mat->GetTexture(aiTextureType_METALNESS, 0, &filename);
-                path = directory + '/' + filename.C_Str();
-                m.textures.metallic = LoadTexture(path);
-            }
-            else
-            {
-                m.textures.metallic = LoadTexture(TEXTURE_DEFAULT_BLACK);
-            }
-
-            if(mat->GetTextureCount(aiTextureType_DIFFUSE_ROUGHNESS) > 0)
-            {
-                mat->GetTexture(aiTextureType_DIFFUSE_ROUGHNESS, 0, &filename);
-                path = directory + '/' + filename.C_Str();
-                m.textures.roughness = LoadTexture(path);
-            }
-            else
-            {
-                m.textures.roughness = LoadTexture(TEXTURE_DEFAULT_BLACK);
-            }
-            
-            if(mat->GetTextureCount(aiTextureType_AMBIENT_OCCLUSION) > 0)
-            {
-                mat->GetTexture(aiTextureType_AMBIENT_OCCLUSION, 0, &filename);
-                path = directory + '/' + filename.C_Str();
-                m.textures.ao = LoadTexture(path);
-            }
-            else if(mat->GetTextureCount(aiTextureType_AMBIENT) > 0)
-            {
-                mat->GetTexture(aiTextureType_AMBIENT, 0, &filename);
-                path = directory + '/' + filename.C_Str();
-                m.textures.ao = LoadTexture(path);
-            }
-            else
-            {
-                m.textures.ao = LoadTexture(TEXTURE_DEFAULT_WHITE);
-            }
+        mesh_data m = MeshData(vertex_count, &vertex_list[0], index_count, &index_list[0]);
+        m.material_index = AddMaterial(&global_material_system, LoadTextureGroup(texture_paths));
+        if(cache)
+        {
+            AddMeshToCache(cache, vertex_list, vertex_count, index_list, index_count, texture_paths);
         }
+        EndTemporaryMemory(mesh_memory);
         mesh_list.push_back(m);
     }
     for(u32 child_index = 0; child_index < node->mNumChildren; child_index++)
     {
-        ProcessNode(mesh_list, directory, node->mChildren[child_index], scene);
+        ProcessNode(mesh_list, directory, node->mChildren[child_index], scene, scratch_arena, cache);
     }
 }
 
-void LoadModel(std::vector<mesh_data> &mesh_list, std::string path)
+// NOTE: warm starts load the binary cache written the first time the model
+//       went through assimp, delete the .rdcache file to force a reimport
+void LoadModel(std::vector<mesh_data> &mesh_list, std::string path, memory_arena *scratch_arena)
 {
     std::string directory = path.substr(0, path.find_last_of('/'));
     path = ASSETS_FOLDER + path;
+    std::string cache_path = path + MESH_CACHE_EXTENSION;
+    if(LoadModelFromCache(mesh_list, cache_path, path))
+    {
+        return;
+    }
+
     Assimp::Importer import;
     const aiScene *scene = import.ReadFile(path, aiProcess_Triangulate | 
                                            aiProcess_FlipUVs | 
@@ -345,7 +593,15 @@ void LoadModel(std::vector<mesh_data> &mesh_list, std::string path)
     {
         // TODO: debug
     }
-    ProcessNode(mesh_list, directory, scene->mRootNode, scene);
+    std::string temp_cache_path = cache_path + ".tmp";
+    mesh_cache_writer cache_writer = {};
+    b32 write_cache = BeginMeshCache(&cache_writer, temp_cache_path);
+    ProcessNode(mesh_list, directory, scene->mRootNode, scene, scratch_arena, write_cache ? &cache_writer : NULL);
+    if(write_cache)
+    {
+        EndMeshCache(&cache_writer, temp_cache_path, cache_path, path);
+    }
+    ResetArena(scratch_arena);
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,387 @@
+#ifndef RD_TEXTURE_H
+#define RD_TEXTURE_H
+
+#include "glad/glad.h"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <iostream>
+
+#include "rd_texture_compression.h"
+#include "rd_gl_state.h"
+
+// NOTE: S3TC is an extension even in 4.6 so the loader doesn't define these
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+// NOTE: set at startup, BC4/BC5 (RGTC) are core so only BC1/BC3 depend on it
+GLOBAL b32 texture_compression_s3tc_supported;
+
+void ReplaceAll(std::string& input, std::string &old_char, std::string &new_char)
+{
+    size_t pos = 0;
+    while ((pos = input.find(old_char, pos)) != std::string::npos)
+    {
+        input.replace(pos, old_char.size(), new_char);
+        pos += new_char.size();
+    }
+}
+
+void UploadTexture(GLuint texture_id, u8 *data, i32 texture_width, i32 texture_height, i32 channel_count)
+{
+    GLenum format = GL_RGBA;
+    if(channel_count == 1)
+    {
+        format = GL_RED;
+    }
+    else if(channel_count == 2)
+    {
+        format = GL_RG;
+    }
+    else if(channel_count == 3)
+    {
+        format = GL_RGB;
+    }
+    else if(channel_count == 4)
+    {
+        format = GL_RGBA;
+    }
+    GLBindTexture(GL_TEXTURE_2D, texture_id);
+    glTexImage2D(GL_TEXTURE_2D, 0, format, texture_width, texture_height,
+                 0, format, GL_UNSIGNED_BYTE, data);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    GLBindTexture(GL_TEXTURE_2D, 0);
+}
+
+GLenum GetCompressedTextureFormat(u32 format)
+{
+    GLenum result = 0;
+    switch(format)
+    {
+        case TextureBlockFormat_BC1:
+        {
+            result = texture_compression_s3tc_supported ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : 0;
+        } break;
+        case TextureBlockFormat_BC3:
+        {
+            result = texture_compression_s3tc_supported ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : 0;
+        } break;
+        case TextureBlockFormat_BC4:
+        {
+            result = GL_COMPRESSED_RED_RGTC1;
+        } break;
+        case TextureBlockFormat_BC5:
+        {
+            result = GL_COMPRESSED_RG_RGTC2;
+        } break;
+    }
+
+    return(result);
+}
+
+// NOTE: the compressed container written by the offline compressor next to the image,
+//       NULL when there's none, it's stale or the gpu can't sample its format
+u8 *LoadTextureContainer(std::string &path)
+{
+    std::string container_path = path + TEXTURE_CONTAINER_EXTENSION;
+    u64 size;
+    u8 *result = ReadTextureContainer(container_path.c_str(), path.c_str(), &size);
+    if(result && !GetCompressedTextureFormat(((texture_container_header *)result)->format))
+    {
+        free(result);
+        result = NULL;
+    }
+
+    return(result);
+}
+
+// NOTE: the mips come precomputed so there's no glGenerateMipmap
+void UploadCompressedTexture(GLuint texture_id, u8 *container)
+{
+    texture_container_header *header = (texture_container_header *)container;
+    GLenum format = GetCompressedTextureFormat(header->format);
+    GLBindTexture(GL_TEXTURE_2D, texture_id);
+    for(u32 level = 0; level < header->mip_count; level++)
+    {
+        glCompressedTexImage2D(GL_TEXTURE_2D, level, format,
+                               GetMipDimension(header->width, level), GetMipDimension(header->height, level),
+                               0, (GLsizei)header->mip_size[level], container + header->mip_offset[level]);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, header->mip_count - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    GLBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// NOTE: decoding happens on worker threads, the GL thread only creates the texture
+//       objects and uploads the decoded pixels in ProcessLoadedTextures
+#define MAX_TEXTURE_UPLOADS_PER_FRAME 4
+
+struct texture_job
+{
+    GLuint texture_id;
+    std::string path;
+};
+
+struct decoded_texture
+{
+    GLuint texture_id;
+    std::string path;
+    u8 *container;
+    u8 *data;
+    i32 width;
+    i32 height;
+    i32 channel_count;
+};
+
+struct texture_loader
+{
+    b32 is_running;
+    b32 is_quitting;
+    std::vector<std::thread> worker_list;
+    std::mutex mutex;
+    std::condition_variable job_available;
+    std::deque<texture_job> job_queue;
+    std::vector<decoded_texture> decoded_list;
+
+    // NOTE: only touched by the main thread, textures in the pending set still
+    //       hold their placeholder, upload_count goes up every time one is replaced
+    std::unordered_set<GLuint> pending_set;
+    u64 upload_count;
+};
+
+GLOBAL texture_loader global_texture_loader;
+
+void TextureWorker(texture_loader *loader)
+{
+    // NOTE: the flip flag is thread local when using the _thread version
+    stbi_set_flip_vertically_on_load_thread(true);
+    for(;;)
+    {
+        texture_job job;
+        {
+            std::unique_lock<std::mutex> lock(loader->mutex);
+            loader->job_available.wait(lock, [loader]{ return(loader->is_quitting || !loader->job_queue.empty()); });
+            if(loader->job_queue.empty())
+            {
+                return;
+            }
+            job = loader->job_queue.front();
+            loader->job_queue.pop_front();
+        }
+
+        decoded_texture texture;
+        texture.texture_id = job.texture_id;
+        texture.path = job.path;
+        texture.data = NULL;
+        texture.container = LoadTextureContainer(job.path);
+        if(!texture.container)
+        {
+            texture.data = stbi_load(job.path.c_str(), &texture.width, &texture.height, &texture.channel_count, 0);
+        }
+
+        std::lock_guard<std::mutex> lock(loader->mutex);
+        loader->decoded_list.push_back(texture);
+    }
+}
+
+void StartTextureLoader(u32 thread_count)
+{
+    texture_loader *loader = &global_texture_loader;
+    Assert(!loader->is_running);
+    thread_count = Maximum(thread_count, 1u);
+    loader->is_quitting = false;
+    for(u32 i = 0; i < thread_count; i++)
+    {
+        loader->worker_list.push_back(std::thread(TextureWorker, loader));
+    }
+    loader->is_running = true;
+}
+
+// NOTE: the workers finish the queued jobs before exiting
+void StopTextureLoader(void)
+{
+    texture_loader *loader = &global_texture_loader;
+    if(!loader->is_running)
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(loader->mutex);
+        loader->is_quitting = true;
+    }
+    loader->job_available.notify_all();
+    for(std::thread &worker : loader->worker_list)
+    {
+        worker.join();
+    }
+    loader->worker_list.clear();
+    loader->is_running = false;
+}
+
+// NOTE: uploads at most max_upload_count decoded textures so a frame
+//       doesn't stall on a burst of big uploads, returns how many are still pending
+u32 ProcessLoadedTextures(u32 max_upload_count)
+{
+    texture_loader *loader = &global_texture_loader;
+    std::vector<decoded_texture> ready_list;
+    {
+        std::lock_guard<std::mutex> lock(loader->mutex);
+        u32 ready_count = Minimum((u32)loader->decoded_list.size(), max_upload_count);
+        ready_list.assign(loader->decoded_list.begin(), loader->decoded_list.begin() + ready_count);
+        loader->decoded_list.erase(loader->decoded_list.begin(), loader->decoded_list.begin() + ready_count);
+    }
+
+    for(decoded_texture &texture : ready_list)
+    {
+        if(texture.container)
+        {
+            UploadCompressedTexture(texture.texture_id, texture.container);
+        }
+        else if(texture.data)
+        {
+            UploadTexture(texture.texture_id, texture.data, texture.width, texture.height, texture.channel_count);
+        }
+        else
+        {
+            // NOTE: the texture keeps its placeholder
+            std::cout << "failed to load texture: " << texture.path << std::endl;
+        }
+        free(texture.container);
+        stbi_image_free(texture.data);
+        loader->pending_set.erase(texture.texture_id);
+        loader->upload_count++;
+    }
+
+    return((u32)loader->pending_set.size());
+}
+
+// NOTE: false while the texture still holds its placeholder
+b32 IsTextureLoaded(GLuint texture_id)
+{
+    b32 result = (global_texture_loader.pending_set.count(texture_id) == 0);
+
+    return(result);
+}
+
+// NOTE: speeding up texture loading momentarily
+// TODO: texture system/db, separate handling of gltf textures,
+//       specify flip for each texture
+GLOBAL std::unordered_map<std::string, GLuint> global_loaded_textures;
+GLOBAL std::unordered_map<std::string, u32> global_placeholder_colors;
+
+// NOTE: the default textures are a single flat color,
+//       the first pixel is used to fill the placeholders
+u32 GetPlaceholderColor(const char *placeholder)
+{
+    auto found = global_placeholder_colors.find(placeholder);
+    if(found != global_placeholder_colors.end())
+    {
+        return(found->second);
+    }
+
+    u32 result = 0xFFFFFFFF;
+    std::string path = std::string(ASSETS_FOLDER) + placeholder;
+    i32 width, height, channel_count;
+    u8 *data = stbi_load(path.c_str(), &width, &height, &channel_count, 4);
+    if(data)
+    {
+        memcpy(&result, data, sizeof(result));
+    }
+    stbi_image_free(data);
+    global_placeholder_colors.insert({placeholder, result});
+
+    return(result);
+}
+
+// NOTE: the next LoadTexture of their files creates new textures instead of returning these
+void ForgetLoadedTextures(std::unordered_set<GLuint> &texture_set)
+{
+    for(auto it = global_loaded_textures.begin(); it != global_loaded_textures.end();)
+    {
+        if(texture_set.count(it->second))
+        {
+            it = global_loaded_textures.erase(it);
+        }
+        else
+        {
+            it++;
+        }
+    }
+}
+
+// NOTE: with a placeholder and the texture loader running, the texture is returned
+//       right away filled with the placeholder color and decoded in the background,
+//       otherwise it's decoded and uploaded before returning
+GLuint LoadTexture(std::string filename, const char *placeholder = NULL)
+{
+    // NOTE: just a temporary fix to load some filenames
+    // TODO: custom string library
+    std::string old_char = "\\";
+    std::string new_char = "/";
+    ReplaceAll(filename, old_char, new_char);
+    if (global_loaded_textures.find(filename) != global_loaded_textures.end()) {
+        return(global_loaded_textures.at(filename));
+    }
+    GLuint texture_id;
+    glGenTextures(1, &texture_id);
+    std::string path = ASSETS_FOLDER + filename;
+    // TODO: add this print in a possible debug build
+    //std::cout << "loading texture: " << path << std::endl;
+
+    texture_loader *loader = &global_texture_loader;
+    if(placeholder && loader->is_running)
+    {
+        u32 color = GetPlaceholderColor(placeholder);
+        UploadTexture(texture_id, (u8 *)&color, 1, 1, 4);
+        {
+            std::lock_guard<std::mutex> lock(loader->mutex);
+            loader->job_queue.push_back({texture_id, path});
+        }
+        loader->pending_set.insert(texture_id);
+        loader->job_available.notify_one();
+    }
+    else if(u8 *container = LoadTextureContainer(path))
+    {
+        UploadCompressedTexture(texture_id, container);
+        free(container);
+    }
+    else
+    {
+        i32 texture_width, texture_height, channel_count;
+        stbi_set_flip_vertically_on_load_thread(true);
+        u8 *data = stbi_load(path.c_str(), &texture_width, &texture_height, &channel_count, 0);
+        if(data)
+        {
+            UploadTexture(texture_id, data, texture_width, texture_height, channel_count);
+        }
+        else
+        {
+            Assert(!"failed to load texture");
+        }
+        stbi_image_free(data);
+        stbi_set_flip_vertically_on_load_thread(false);
+    }
+    global_loaded_textures.insert({filename, texture_id});
+
+    return(texture_id);
+}
+
+#endif
@@ -0,0 +1,608 @@
+#ifndef RD_TEXTURE_COMPRESSION_H
+#define RD_TEXTURE_COMPRESSION_H
+
+// NOTE: block compression (BC1/BC3/BC4/BC5) and the container the offline
+//       compressor writes, doesn't depend on GL so it can be used and checked on the cpu
+
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "sys/stat.h"
+
+// NOTE: container written next to the source image. Layout: header, then every mip
+//       level as rows of 4x4 blocks. Rows are stored bottom to top, the same as the
+//       flipped stbi_load output. Bump TEXTURE_CONTAINER_VERSION whenever the layout
+//       or the encoders change
+#define TEXTURE_CONTAINER_EXTENSION ".rdtex"
+#define TEXTURE_CONTAINER_MAGIC 0x58544452 // NOTE: "RDTX"
+#define TEXTURE_CONTAINER_VERSION 1
+#define TEXTURE_MAX_MIP_COUNT 16
+
+enum texture_block_format
+{
+    TextureBlockFormat_None,
+    TextureBlockFormat_BC1, // NOTE: rgb, 4 bits per pixel
+    TextureBlockFormat_BC3, // NOTE: rgba, 8 bits per pixel
+    TextureBlockFormat_BC4, // NOTE: r, 4 bits per pixel (RGTC1)
+    TextureBlockFormat_BC5, // NOTE: rg, 8 bits per pixel (RGTC2), used for normal maps
+    TextureBlockFormat_Count,
+};
+
+struct texture_container_header
+{
+    u32 magic;
+    u32 version;
+    u32 format;
+    u32 width;
+    u32 height;
+    u32 mip_count;
+    u64 source_size;
+    i64 source_mtime;
+    u64 mip_offset[TEXTURE_MAX_MIP_COUNT];
+    u64 mip_size[TEXTURE_MAX_MIP_COUNT];
+};
+
+b32 GetFileInfo(const char *path, u64 *size, i64 *mtime)
+{
+    struct stat info;
+    if(stat(path, &info) != 0)
+    {
+        return(false);
+    }
+    *size = (u64)info.st_size;
+    *mtime = (i64)info.st_mtime;
+
+    return(true);
+}
+
+u32 GetBlockSize(u32 format)
+{
+    u32 result = 0;
+    if((format == TextureBlockFormat_BC1) || (format == TextureBlockFormat_BC4))
+    {
+        result = 8;
+    }
+    else if((format == TextureBlockFormat_BC3) || (format == TextureBlockFormat_BC5))
+    {
+        result = 16;
+    }
+
+    return(result);
+}
+
+u64 GetCompressedMipSize(u32 format, u32 width, u32 height)
+{
+    u64 result = (u64)((width + 3) / 4) * (u64)((height + 3) / 4) * GetBlockSize(format);
+
+    return(result);
+}
+
+// NOTE: full chain down to 1x1
+u32 GetMipCount(u32 width, u32 height)
+{
+    u32 result = 1;
+    while(((width > 1) || (height > 1)) && (result < TEXTURE_MAX_MIP_COUNT))
+    {
+        width = Maximum(width / 2, 1u);
+        height = Maximum(height / 2, 1u);
+        result++;
+    }
+
+    return(result);
+}
+
+u32 GetMipDimension(u32 dimension, u32 level)
+{
+    u32 result = Maximum(dimension >> level, 1u);
+
+    return(result);
+}
+
+// NOTE: rgba8 image, odd dimensions just repeat the last row/column
+void DownsampleImage(u8 *source, u32 width, u32 height, u8 *dest, b32 is_normal_map)
+{
+    u32 dest_width = Maximum(width / 2, 1u);
+    u32 dest_height = Maximum(height / 2, 1u);
+    for(u32 y = 0; y < dest_height; y++)
+    {
+        u32 y0 = Minimum(y * 2, height - 1);
+        u32 y1 = Minimum(y * 2 + 1, height - 1);
+        for(u32 x = 0; x < dest_width; x++)
+        {
+            u32 x0 = Minimum(x * 2, width - 1);
+            u32 x1 = Minimum(x * 2 + 1, width - 1);
+            u8 *a = source + (y0 * width + x0) * 4;
+            u8 *b = source + (y0 * width + x1) * 4;
+            u8 *c = source + (y1 * width + x0) * 4;
+            u8 *d = source + (y1 * width + x1) * 4;
+            u8 *out = dest + (y * dest_width + x) * 4;
+            for(u32 channel = 0; channel < 4; channel++)
+            {
+                out[channel] = (u8)((a[channel] + b[channel] + c[channel] + d[channel] + 2) / 4);
+            }
+
+            // NOTE: averaging shortens the normals, put them back on the unit sphere
+            if(is_normal_map)
+            {
+                vec3 n = Vec3(out[0] / 127.5f - 1.0f, out[1] / 127.5f - 1.0f, out[2] / 127.5f - 1.0f);
+                f32 length = sqrtf(n.x * n.x + n.y * n.y + n.z * n.z);
+                if(length > 0.0f)
+                {
+                    out[0] = (u8)Minimum((n.x / length + 1.0f) * 127.5f + 0.5f, 255.0f);
+                    out[1] = (u8)Minimum((n.y / length + 1.0f) * 127.5f + 0.5f, 255.0f);
+                    out[2] = (u8)Minimum((n.z / length + 1.0f) * 127.5f + 0.5f, 255.0f);
+                }
+            }
+        }
+    }
+}
+
+// NOTE: copies a 4x4 rgba block, the edges are replicated for sizes
+//       that aren't a multiple of 4
+void FetchBlock(u8 *image, u32 width, u32 height, u32 block_x, u32 block_y, u8 *block)
+{
+    for(u32 y = 0; y < 4; y++)
+    {
+        u32 source_y = Minimum(block_y * 4 + y, height - 1);
+        for(u32 x = 0; x < 4; x++)
+        {
+            u32 source_x = Minimum(block_x * 4 + x, width - 1);
+            memcpy(block + (y * 4 + x) * 4, image + (source_y * width + source_x) * 4, 4);
+        }
+    }
+}
+
+void StoreBlock(u8 *block, u32 width, u32 height, u32 block_x, u32 block_y, u8 *image)
+{
+    for(u32 y = 0; y < 4; y++)
+    {
+        for(u32 x = 0; x < 4; x++)
+        {
+            u32 dest_x = block_x * 4 + x;
+            u32 dest_y = block_y * 4 + y;
+            if((dest_x < width) && (dest_y < height))
+            {
+                memcpy(image + (dest_y * width + dest_x) * 4, block + (y * 4 + x) * 4, 4);
+            }
+        }
+    }
+}
+
+u16 PackRGB565(vec3 color)
+{
+    u32 r = (u32)(Clamp(color.x, 0.0f, 255.0f) * (31.0f / 255.0f) + 0.5f);
+    u32 g = (u32)(Clamp(color.y, 0.0f, 255.0f) * (63.0f / 255.0f) + 0.5f);
+    u32 b = (u32)(Clamp(color.z, 0.0f, 255.0f) * (31.0f / 255.0f) + 0.5f);
+    u16 result = (u16)((r << 11) | (g << 5) | b);
+
+    return(result);
+}
+
+void UnpackRGB565(u16 color, u8 *out)
+{
+    u32 r = (color >> 11) & 31;
+    u32 g = (color >> 5) & 63;
+    u32 b = color & 31;
+    out[0] = (u8)((r << 3) | (r >> 2));
+    out[1] = (u8)((g << 2) | (g >> 4));
+    out[2] = (u8)((b << 3) | (b >> 2));
+}
+
+// NOTE: palette as the hardware decodes it, with four_color false
+//       color 2 is the midpoint and color 3 is black
+void GetColorPalette(u16 color0, u16 color1, b32 four_color, u8 palette[4][4])
+{
+    UnpackRGB565(color0, palette[0]);
+    UnpackRGB565(color1, palette[1]);
+    for(u32 channel = 0; channel < 3; channel++)
+    {
+        if(four_color)
+        {
+            palette[2][channel] = (u8)((2 * palette[0][channel] + palette[1][channel]) / 3);
+            palette[3][channel] = (u8)((palette[0][channel] + 2 * palette[1][channel]) / 3);
+        }
+        else
+        {
+            palette[2][channel] = (u8)((palette[0][channel] + palette[1][channel]) / 2);
+            palette[3][channel] = 0;
+        }
+    }
+    palette[0][3] = palette[1][3] = palette[2][3] = 255;
+    palette[3][3] = four_color ? 255 : 0;
+}
+
+u32 ComputeColorIndices(u8 *block, u16 color0, u16 color1, u32 *error)
+{
+    u8 palette[4][4];
+    GetColorPalette(color0, color1, true, palette);
+    u32 result = 0;
+    *error = 0;
+    for(u32 i = 0; i < 16; i++)
+    {
+        u8 *pixel = block + i * 4;
+        u32 best_index = 0;
+        u32 best_error = 0xFFFFFFFF;
+        for(u32 index = 0; index < 4; index++)
+        {
+            i32 dr = pixel[0] - palette[index][0];
+            i32 dg = pixel[1] - palette[index][1];
+            i32 db = pixel[2] - palette[index][2];
+            u32 distance = (u32)(dr * dr + dg * dg + db * db);
+            if(distance < best_error)
+            {
+                best_error = distance;
+                best_index = index;
+            }
+        }
+        result |= best_index << (i * 2);
+        *error += best_error;
+    }
+
+    return(result);
+}
+
+// NOTE: color0 > color1 selects the four color mode, equal colors decode the
+//       same either way since every index ends up being 0
+u32 ComputeOrderedColorIndices(u8 *block, u16 *color0, u16 *color1, u32 *error)
+{
+    if(*color0 < *color1)
+    {
+        u16 temp = *color0;
+        *color0 = *color1;
+        *color1 = temp;
+    }
+    u32 result = ComputeColorIndices(block, *color0, *color1, error);
+
+    return(result);
+}
+
+// NOTE: endpoints from the principal axis of the block colors,
+//       then one least squares refit of the endpoints for the chosen indices
+void EncodeColorBlock(u8 *block, u8 *out)
+{
+    vec3 mean = Vec3(0.0f);
+    for(u32 i = 0; i < 16; i++)
+    {
+        mean += Vec3(block[i * 4 + 0], block[i * 4 + 1], block[i * 4 + 2]);
+    }
+    mean = mean / 16.0f;
+
+    f32 covariance[6] = {};
+    for(u32 i = 0; i < 16; i++)
+    {
+        vec3 d = Vec3(block[i * 4 + 0], block[i * 4 + 1], block[i * 4 + 2]) - mean;
+        covariance[0] += d.x * d.x;
+        covariance[1] += d.x * d.y;
+        covariance[2] += d.x * d.z;
+        covariance[3] += d.y * d.y;
+        covariance[4] += d.y * d.z;
+        covariance[5] += d.z * d.z;
+    }
+
+    vec3 axis = Vec3(1.0f, 1.0f, 1.0f);
+    for(u32 iteration = 0; iteration < 8; iteration++)
+    {
+        vec3 next = Vec3(covariance[0] * axis.x + covariance[1] * axis.y + covariance[2] * axis.z,
+                         covariance[1] * axis.x + covariance[3] * axis.y + covariance[4] * axis.z,
+                         covariance[2] * axis.x + covariance[4] * axis.y + covariance[5] * axis.z);
+        f32 length = Maximum(Maximum(fabsf(next.x), fabsf(next.y)), fabsf(next.z));
+        if(length < FLT_EPSILON)
+        {
+            break;
+        }
+        axis = next / length;
+    }
+    f32 axis_length_sq = DotProduct(axis, axis);
+
+    f32 min_t = 0.0f;
+    f32 max_t = 0.0f;
+    for(u32 i = 0; i < 16; i++)
+    {
+        vec3 d = Vec3(block[i * 4 + 0], block[i * 4 + 1], block[i * 4 + 2]) - mean;
+        f32 t = DotProduct(d, axis) / axis_length_sq;
+        min_t = Minimum(min_t, t);
+        max_t = Maximum(max_t, t);
+    }
+
+    u16 color0 = PackRGB565(mean + axis * max_t);
+    u16 color1 = PackRGB565(mean + axis * min_t);
+    u32 error;
+    u32 indices = ComputeOrderedColorIndices(block, &color0, &color1, &error);
+
+    // NOTE: weight of color0 for every index in four color mode
+    LOCAL const f32 color0_weight[4] = {1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f};
+    f32 aa = 0.0f, bb = 0.0f, ab = 0.0f;
+    vec3 ax = Vec3(0.0f);
+    vec3 bx = Vec3(0.0f);
+    for(u32 i = 0; i < 16; i++)
+    {
+        f32 a = color0_weight[(indices >> (i * 2)) & 3];
+        f32 b = 1.0f - a;
+        vec3 x = Vec3(block[i * 4 + 0], block[i * 4 + 1], block[i * 4 + 2]);
+        aa += a * a;
+        bb += b * b;
+        ab += a * b;
+        ax += x * a;
+        bx += x * b;
+    }
+    f32 determinant = aa * bb - ab * ab;
+    if(fabsf(determinant) > FLT_EPSILON)
+    {
+        u16 refit_color0 = PackRGB565((ax * bb - bx * ab) / determinant);
+        u16 refit_color1 = PackRGB565((bx * aa - ax * ab) / determinant);
+        u32 refit_error;
+        u32 refit_indices = ComputeOrderedColorIndices(block, &refit_color0, &refit_color1, &refit_error);
+        if(refit_error < error)
+        {
+            color0 = refit_color0;
+            color1 = refit_color1;
+            indices = refit_indices;
+        }
+    }
+
+    out[0] = (u8)(color0 & 0xFF);
+    out[1] = (u8)(color0 >> 8);
+    out[2] = (u8)(color1 & 0xFF);
+    out[3] = (u8)(color1 >> 8);
+    out[4] = (u8)(indices & 0xFF);
+    out[5] = (u8)((indices >> 8) & 0xFF);
+    out[6] = (u8)((indices >> 16) & 0xFF);
+    out[7] = (u8)(indices >> 24);
+}
+
+// NOTE: values has a stride so the same code encodes any channel of a rgba block,
+//       always uses the 8 value mode (value0 > value1)
+void EncodeValueBlock(u8 *values, u32 stride, u8 *out)
+{
+    u8 min_value = 255;
+    u8 max_value = 0;
+    for(u32 i = 0; i < 16; i++)
+    {
+        min_value = Minimum(min_value, values[i * stride]);
+        max_value = Maximum(max_value, values[i * stride]);
+    }
+
+    out[0] = max_value;
+    out[1] = min_value;
+    u64 indices = 0;
+    if(max_value > min_value)
+    {
+        u32 palette[8];
+        palette[0] = max_value;
+        palette[1] = min_value;
+        for(u32 index = 2; index < 8; index++)
+        {
+            palette[index] = ((8 - index) * max_value + (index - 1) * min_value) / 7;
+        }
+        for(u32 i = 0; i < 16; i++)
+        {
+            u32 value = values[i * stride];
+            u64 best_index = 0;
+            u32 best_error = 0xFFFFFFFF;
+            for(u32 index = 0; index < 8; index++)
+            {
+                u32 distance = (value > palette[index]) ? (value - palette[index]) : (palette[index] - value);
+                if(distance < best_error)
+                {
+                    best_error = distance;
+                    best_index = index;
+                }
+            }
+            indices |= best_index << (i * 3);
+        }
+    }
+    for(u32 i = 0; i < 6; i++)
+    {
+        out[2 + i] = (u8)((indices >> (i * 8)) & 0xFF);
+    }
+}
+
+void DecodeColorBlock(u8 *block, b32 force_four_color, u8 *out)
+{
+    u16 color0 = (u16)(block[0] | (block[1] << 8));
+    u16 color1 = (u16)(block[2] | (block[3] << 8));
+    u32 indices = (u32)block[4] | ((u32)block[5] << 8) | ((u32)block[6] << 16) | ((u32)block[7] << 24);
+    u8 palette[4][4];
+    GetColorPalette(color0, color1, force_four_color || (color0 > color1), palette);
+    for(u32 i = 0; i < 16; i++)
+    {
+        memcpy(out + i * 4, palette[(indices >> (i * 2)) & 3], 4);
+    }
+}
+
+void DecodeValueBlock(u8 *block, u32 stride, u8 *out)
+{
+    u32 value0 = block[0];
+    u32 value1 = block[1];
+    u32 palette[8];
+    palette[0] = value0;
+    palette[1] = value1;
+    for(u32 index = 2; index < 8; index++)
+    {
+        if(value0 > value1)
+        {
+            palette[index] = ((8 - index) * value0 + (index - 1) * value1) / 7;
+        }
+        else if(index < 6)
+        {
+            palette[index] = ((6 - index) * value0 + (index - 1) * value1) / 5;
+        }
+        else
+        {
+            palette[index] = (index == 6) ? 0 : 255;
+        }
+    }
+    u64 indices = 0;
+    for(u32 i = 0; i < 6; i++)
+    {
+        indices |= (u64)block[2 + i] << (i * 8);
+    }
+    for(u32 i = 0; i < 16; i++)
+    {
+        out[i * stride] = (u8)palette[(indices >> (i * 3)) & 7];
+    }
+}
+
+void EncodeBlock(u8 *block, u32 format, u8 *out)
+{
+    switch(format)
+    {
+        case TextureBlockFormat_BC1:
+        {
+            EncodeColorBlock(block, out);
+        } break;
+        case TextureBlockFormat_BC3:
+        {
+            EncodeValueBlock(block + 3, 4, out);
+            EncodeColorBlock(block, out + 8);
+        } break;
+        case TextureBlockFormat_BC4:
+        {
+            EncodeValueBlock(block, 4, out);
+        } break;
+        case TextureBlockFormat_BC5:
+        {
+            EncodeValueBlock(block, 4, out);
+            EncodeValueBlock(block + 1, 4, out + 8);
+        } break;
+        default:
+        {
+            Assert(!"unknown texture block format");
+        } break;
+    }
+}
+
+// NOTE: fills the channels missing from the format the same way GL does
+void DecodeBlock(u8 *block, u32 format, u8 *out)
+{
+    switch(format)
+    {
+        case TextureBlockFormat_BC1:
+        {
+            DecodeColorBlock(block, false, out);
+        } break;
+        case TextureBlockFormat_BC3:
+        {
+            DecodeColorBlock(block + 8, true, out);
+            DecodeValueBlock(block, 4, out + 3);
+        } break;
+        case TextureBlockFormat_BC4:
+        case TextureBlockFormat_BC5:
+        {
+            for(u32 i = 0; i < 16; i++)
+            {
+                out[i * 4 + 1] = 0;
+                out[i * 4 + 2] = 0;
+                out[i * 4 + 3] = 255;
+            }
+            DecodeValueBlock(block, 4, out);
+            if(format == TextureBlockFormat_BC5)
+            {
+                DecodeValueBlock(block + 8, 4, out + 1);
+            }
+        } break;
+        default:
+        {
+            Assert(!"unknown texture block format");
+        } break;
+    }
+}
+
+// NOTE: image is rgba8, out must hold GetCompressedMipSize bytes
+void CompressImage(u8 *image, u32 width, u32 height, u32 format, u8 *out)
+{
+    u32 block_size = GetBlockSize(format);
+    u32 blocks_x = (width + 3) / 4;
+    u32 blocks_y = (height + 3) / 4;
+    u8 block[16 * 4];
+    for(u32 block_y = 0; block_y < blocks_y; block_y++)
+    {
+        for(u32 block_x = 0; block_x < blocks_x; block_x++)
+        {
+            FetchBlock(image, width, height, block_x, block_y, block);
+            EncodeBlock(block, format, out + (block_y * blocks_x + block_x) * block_size);
+        }
+    }
+}
+
+void DecompressImage(u8 *data, u32 width, u32 height, u32 format, u8 *image)
+{
+    u32 block_size = GetBlockSize(format);
+    u32 blocks_x = (width + 3) / 4;
+    u32 blocks_y = (height + 3) / 4;
+    u8 block[16 * 4];
+    for(u32 block_y = 0; block_y < blocks_y; block_y++)
+    {
+        for(u32 block_x = 0; block_x < blocks_x; block_x++)
+        {
+            DecodeBlock(data + (block_y * blocks_x + block_x) * block_size, format, block);
+            StoreBlock(block, width, height, block_x, block_y, image);
+        }
+    }
+}
+
+// NOTE: checks everything the loader relies on, the source file info is
+//       compared only when source_path is given
+b32 IsTextureContainerValid(u8 *data, u64 size, const char *source_path)
+{
+    if(size < sizeof(texture_container_header))
+    {
+        return(false);
+    }
+    texture_container_header *header = (texture_container_header *)data;
+    b32 result = ((header->magic == TEXTURE_CONTAINER_MAGIC) &&
+                  (header->version == TEXTURE_CONTAINER_VERSION) &&
+                  (header->format > TextureBlockFormat_None) &&
+                  (header->format < TextureBlockFormat_Count) &&
+                  (header->width > 0) && (header->height > 0) &&
+                  (header->mip_count > 0) && (header->mip_count <= TEXTURE_MAX_MIP_COUNT));
+    for(u32 level = 0; result && (level < header->mip_count); level++)
+    {
+        u64 expected_size = GetCompressedMipSize(header->format, GetMipDimension(header->width, level),
+                                                 GetMipDimension(header->height, level));
+        result = ((header->mip_size[level] == expected_size) &&
+                  (header->mip_offset[level] + header->mip_size[level] <= size));
+    }
+    if(result && source_path)
+    {
+        u64 source_size;
+        i64 source_mtime;
+        result = (GetFileInfo(source_path, &source_size, &source_mtime) &&
+                  (header->source_size == source_size) &&
+                  (header->source_mtime == source_mtime));
+    }
+
+    return(result);
+}
+
+// NOTE: returns the whole file in a malloc'd buffer, NULL if it's
+//       missing, corrupted or older than the source image
+u8 *ReadTextureContainer(const char *path, const char *source_path, u64 *size)
+{
+    FILE *file = fopen(path, "rb");
+    if(!file)
+    {
+        return(NULL);
+    }
+    fseek(file, 0, SEEK_END);
+    i64 file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    u8 *result = NULL;
+    if(file_size > 0)
+    {
+        result = (u8 *)malloc(file_size);
+        if(result && ((fread(result, 1, file_size, file) != (u64)file_size) ||
+                      !IsTextureContainerValid(result, file_size, source_path)))
+        {
+            free(result);
+            result = NULL;
+        }
+    }
+    fclose(file);
+    *size = (u64)file_size;
+
+    return(result);
+}
+
+#endif
@@ -5,11 +5,17 @@
 #include "thirdparty/stb/stb_image.h"
 
 #include "rd_lib.h"
+#include "rd_memory.h"
 #include "camera.h"
 #include "rd_mesh.h"
+#include "rd_light.h"
+#include "rd_gbuffer.h"
+#include "rd_gpu_profiler.h"
 #include "temp_data.h"
 #include "shader.hpp"
 
+#include <algorithm>
+
 struct game_state
 {
     GLFWwindow *window;
@@ -19,6 +25,7 @@ struct game_state
     f32 delta_time;
     b32 is_running;
     game_camera player_camera;
+    game_memory memory;
 };
 
 GLOBAL u16 default_window_width = 1920;
@@ -30,8 +37,24 @@ GLOBAL vec2 mouse_last_movement;
 #define SHADOW_CASCADES_COUNT 3
 GLOBAL i32 render_debug_quad_layer = SHADOW_CASCADES_COUNT;
 
+// NOTE: when the driver can write gl_Layer from the vertex shader the cascades
+//       are rendered with instancing, otherwise the geometry shader path is used
+GLOBAL b32 shadow_layered_instancing_supported = false;
+GLOBAL b32 shadow_layered_instancing = true;
+
 GLOBAL b32 camera_mode_ortho = false;
 
+// NOTE: chosen at startup with -deferred, the g-buffer and its shaders only exist in that mode.
+//       The scene is lit once per pixel in a full screen pass instead of once per fragment
+GLOBAL b32 deferred_shading = false;
+
+// NOTE: depth only pass of the opaque queue before the color pass, which then runs
+//       with GL_EQUAL and without the alpha test so every pixel is shaded once
+GLOBAL b32 depth_prepass = true;
+
+// NOTE: frames between two reports of the pass times and the renderer counters
+#define GPU_PROFILER_REPORT_FRAMES 256
+
 #define POST_PROCESSING_ENABLED 1
 GLOBAL f32 tonemapping_exposure = 0.5f;
 GLOBAL b32 bloom_enabled = 1;
@@ -42,7 +65,7 @@ GLOBAL i32 tonemapper_choice = 2;
 
 void ResizeCallback(GLFWwindow *window, i32 width, i32 height)
 {
-    glViewport(0, 0, width, height);
+    GLViewport(0, 0, width, height);
     state.window_width = width;
     state.window_height = height;
 }
@@ -158,6 +181,24 @@ void ProcessInput(GLFWwindow *window)
         {
             bloom_enabled = 1;
         }
+
+        if(glfwGetKey(window, GLFW_KEY_I) == GLFW_PRESS)
+        {
+            shadow_layered_instancing = true;
+        }
+        else if(glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS)
+        {
+            shadow_layered_instancing = false;
+        }
+
+        if(glfwGetKey(window, GLFW_KEY_K) == GLFW_PRESS)
+        {
+            depth_prepass = true;
+        }
+        else if(glfwGetKey(window, GLFW_KEY_L) == GLFW_PRESS)
+        {
+            depth_prepass = false;
+        }
     }
     if(glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS)
     {
@@ -185,10 +226,26 @@ void ScrollCallback(GLFWwindow *window, f64 offset_x, f64 offset_y)
     ProcessCameraScroll(&state.player_camera, (f32)offset_y);
 }
 
+b32 HasGLExtension(const char *name)
+{
+    GLint extension_count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extension_count);
+    for(GLint i = 0; i < extension_count; i++)
+    {
+        const char *extension = (const char *)glGetStringi(GL_EXTENSIONS, i);
+        if(extension && (strcmp(extension, name) == 0))
+        {
+            return(true);
+        }
+    }
+
+    return(false);
+}
+
 GLuint LoadCubemap(std::string *face_names, u32 face_count) {
     GLuint texture_id;
     glGenTextures(1, &texture_id);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, texture_id);
+    GLBindTexture(GL_TEXTURE_CUBE_MAP, texture_id);
     i32 texture_width, texture_height, channel_count;
     u8 *data;
     for (u32 i = 0; i < face_count; i++) {
@@ -205,62 +262,11 @@ GLuint LoadCubemap(std::string *face_names, u32 face_count) {
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 
     stbi_image_free(data);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    GLBindTexture(GL_TEXTURE_2D, 0);
 
     return(texture_id);
 }
 
-struct frustum
-{
-    vec4 corners[8];
-    vec3 center;
-};
-vec3 GetFrustumCenter(frustum f)
-{
-    vec3 center = Vec3(0.0f, 0.0f, 0.0f);
-    for(u32 i = 0; i < ArrayCount(f.corners); i++)
-    {
-        center += Vec3(f.corners[i]);
-    }
-    center /= ArrayCount(f.corners);
-
-    return(center);
-}
-
-frustum GetFrustumInWorldSpace(mat4x4 projection_mul_view)
-{
-    mat4x4 to_world_space = Inverse(projection_mul_view);
-
-    frustum f = {{
-        Vec4(-1.0f, -1.0f, -1.0f, 1.0f),
-        Vec4(-1.0f, -1.0f, 1.0f, 1.0f),
-        Vec4(-1.0f, 1.0f, -1.0f, 1.0f),
-        Vec4(-1.0f, 1.0f, 1.0f, 1.0f),
-        Vec4(1.0f, -1.0f, -1.0f, 1.0f),
-        Vec4(1.0f, -1.0f, 1.0f, 1.0f),
-        Vec4(1.0f, 1.0f, -1.0f, 1.0f),
-        Vec4(1.0f, 1.0f, 1.0f, 1.0f),
-    }};
-
-    for(u32 i = 0; i < ArrayCount(f.corners); i++)
-    {
-        f.corners[i] = to_world_space * f.corners[i];
-        f.corners[i] /= f.corners[i].w;
-    }
-
-    f.center = GetFrustumCenter(f);
-
-    return(f);
-}
-
-frustum GetFrustumInWorldSpace(mat4x4 projection, mat4x4 view)
-{
-    mat4x4 projection_mul_view = projection * view;
-    frustum result = GetFrustumInWorldSpace(projection_mul_view);
-
-    return(result);
-}
-
 // NOTE: gets the light space matrix for a single cascade
 mat4x4 GetLightSpaceMatrix(vec3 light_direction, u16 width, u16 height, f32 near_plane, f32 far_plane)
 {
@@ -311,39 +317,64 @@ mat4x4 GetLightSpaceMatrix(vec3 light_direction, u16 width, u16 height, f32 near
     return(result);
 }
 
-#define MAX_POINT_LIGHTS 16
 GLOBAL vec3 default_light_color = Vec3(4.0f);
-struct point_light
+GLOBAL f32 default_light_radius = 10.0f;
+// NOTE: chosen at startup with -lights N, that many lights are added at random
+//       places in the scene on top of the hand placed ones
+GLOBAL u32 random_light_count = 0;
+#define RANDOM_LIGHT_RADIUS 1.5f
+
+// NOTE: std140/std430 mirrors of the blocks declared in the shaders,
+//       matrices are declared row_major there so they can be copied as they are
+#define LIGHT_SPACE_MATRICES_UBO_BINDING 0
+#define FRAME_UBO_BINDING 1
+#define OBJECT_SSBO_BINDING 0
+
+struct frame_uniforms
 {
-    vec3 position;
-    vec3 color;
+    mat4x4 projection_mul_view;
+    mat4x4 view;
+    vec4 viewer_position;
+    vec4 sun_direction;
+    // NOTE: std140 float arrays have a 16 byte stride, only x is used
+    vec4 near_plane_cascades[SHADOW_CASCADES_COUNT];
+    vec4 far_plane_cascades[SHADOW_CASCADES_COUNT];
+    vec4 sun_position;
+    vec4 sun_color;
+    // NOTE: xy only
+    vec4 cluster_tile_size;
+    vec4 cluster_depth_slicing;
 };
 
-void SetLightInShader(ShaderProgram *shader, point_light *light_list, u32 light_count)
+// NOTE: one per node in the object buffer, indexed with the
+//       object index of the per instance attribute
+struct object_data
 {
-    shader->set_int("light_count", light_count);
-    for(u32 i = 0; i < light_count; i++)
-    {
-        std::string position_str = "lights[" + std::to_string(i) + "].position";
-        std::string color_str = "lights[" + std::to_string(i) + "].color";
-        shader->set_vec3(position_str.c_str(), light_list[i].position);
-        shader->set_vec3(color_str.c_str(), light_list[i].color);
-    }
-}
+    mat4x4 model;
+    // NOTE: a row_major mat3 is stored as 3 rows padded to vec4
+    vec4 normal_matrix[3];
+};
 
-void SetTransform(ShaderProgram *shader, vec3 position, vec3 scale = Vec3(1.0f), mat4x4 rotation = Identity())
-{
-    mat4x4 model = Translation(position) * rotation * Scaling(scale);
-    shader->set_mat4("model", model);
-    shader->set_mat3("normal_matrix", Mat3x3(Transpose(Inverse(model)))); 
-}
-void SetTransform(ShaderProgram *shader, vec3 position, f32 scale, mat4x4 rotation)
+static_assert(sizeof(frame_uniforms) == 320, "frame_uniforms std140 layout error");
+static_assert(sizeof(object_data) == 112, "object_data std430 layout error");
+
+GLuint UniformBuffer(u64 size, u32 binding)
 {
-    SetTransform(shader, position, Vec3(scale), rotation);
+    GLuint ubo;
+    glGenBuffers(1, &ubo);
+    glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, binding, ubo);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    return(ubo);
 }
-void SetTransform(ShaderProgram *shader, vec3 position, f32 scale)
+
+void UploadUniformBuffer(GLuint ubo, void *data, u64 size)
 {
-    SetTransform(shader, position, Vec3(scale)); 
+    glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, size, data);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
 }
 
 struct scene_node
@@ -370,16 +401,722 @@ scene_node SceneNode(vec3 position, mat4x4 rotation, vec3 scale, std::vector<mes
     return(result);
 }
 
-void RenderNodeList(ShaderProgram *shader, scene_node *node_list, u32 node_count)
+// NOTE: model and normal matrices of a node list, computed once per frame
+//       with ComputeTransforms and shared by every pass that renders the list
+struct node_transforms
+{
+    u32 count;
+    mat4x4 *model_list;
+    mat3x3 *normal_list;
+};
+
+// NOTE: everything is pushed on the transient arena, so the result
+//       is only valid until the end of the frame
+void ComputeNodeTransforms(node_transforms *transforms, scene_node *node_list, u32 node_count,
+                           memory_arena *transient_arena)
 {
+    // NOTE: 3 position + 3 scale + 9 rotation arrays
+    u32 soa_array_count = 15;
+    transforms->count = node_count;
+    transforms->model_list = PushArray(transient_arena, node_count, mat4x4);
+    transforms->normal_list = PushArray(transient_arena, node_count, mat3x3);
+
+    f32 *soa = PushArray(transient_arena, soa_array_count * node_count, f32);
+    transform_batch batch;
+    batch.count = node_count;
+    batch.position_x = soa + 0 * node_count;
+    batch.position_y = soa + 1 * node_count;
+    batch.position_z = soa + 2 * node_count;
+    batch.scale_x = soa + 3 * node_count;
+    batch.scale_y = soa + 4 * node_count;
+    batch.scale_z = soa + 5 * node_count;
+    for(u32 element = 0; element < 9; element++)
+    {
+        batch.rotation[element] = soa + (6 + element) * node_count;
+    }
+
+    // NOTE: the rotation can carry a translation (e.g. from RotationP), it's applied after the
+    //       scale and before the node position so it just adds to the position
     for(u32 node_index = 0; node_index < node_count; node_index++)
     {
-        scene_node node = node_list[node_index];
-        SetTransform(shader, node.position, node.scale, node.rotation);
-        shader->set_int("use_metallic_roughness", node.gltf_model);
-        for(mesh_data &mesh : node.mesh_list)
+        scene_node *node = &node_list[node_index];
+        Assert(IsAffine(node->rotation));
+        batch.position_x[node_index] = node->position.x + node->rotation.e[0][3];
+        batch.position_y[node_index] = node->position.y + node->rotation.e[1][3];
+        batch.position_z[node_index] = node->position.z + node->rotation.e[2][3];
+        batch.scale_x[node_index] = node->scale.x;
+        batch.scale_y[node_index] = node->scale.y;
+        batch.scale_z[node_index] = node->scale.z;
+        for(u32 element = 0; element < 9; element++)
         {
-            RenderMesh(&mesh);
+            batch.rotation[element][node_index] = node->rotation.e[element / 3][element % 3];
+        }
+    }
+
+    ComputeTransforms(&batch, transforms->model_list, transforms->normal_list);
+}
+
+// NOTE: the object data of every node lives in a single storage buffer
+struct object_buffer
+{
+    GLuint ssbo;
+    u32 capacity;
+};
+
+object_buffer ObjectBuffer(void)
+{
+    object_buffer result = {};
+    glGenBuffers(1, &result.ssbo);
+
+    return(result);
+}
+
+// NOTE: one upload per frame for all the nodes, the staging copy lives in the transient arena
+void UploadObjectData(object_buffer *objects, scene_node *node_list, node_transforms *transforms,
+                      memory_arena *transient_arena)
+{
+    u32 node_count = transforms->count;
+    object_data *staging = PushArray(transient_arena, node_count, object_data);
+    for(u32 node_index = 0; node_index < node_count; node_index++)
+    {
+        object_data *object = &staging[node_index];
+        mat3x3 *normal_matrix = &transforms->normal_list[node_index];
+        object->model = transforms->model_list[node_index];
+        for(u32 row = 0; row < 3; row++)
+        {
+            object->normal_matrix[row] = Vec4(normal_matrix->e[row][0], normal_matrix->e[row][1],
+                                              normal_matrix->e[row][2], 0.0f);
+        }
+    }
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, objects->ssbo);
+    if(node_count > objects->capacity)
+    {
+        objects->capacity = node_count;
+        glBufferData(GL_SHADER_STORAGE_BUFFER, (u64)objects->capacity * sizeof(object_data), NULL, GL_DYNAMIC_DRAW);
+    }
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, (u64)node_count * sizeof(object_data), staging);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, OBJECT_SSBO_BINDING, objects->ssbo);
+}
+
+// NOTE: same layout as the DrawElementsIndirectCommand read by glMultiDrawElementsIndirect
+struct draw_command
+{
+    u32 index_count;
+    u32 instance_count;
+    u32 first_index;
+    i32 base_vertex;
+    u32 base_instance;
+};
+
+// NOTE: read by the per instance attribute of the mesh buffer, parameter is
+//       the material index in the pbr pass and the cascade mask in the shadow pass
+struct draw_instance
+{
+    u32 object_index;
+    u32 parameter;
+};
+
+// NOTE: consecutive commands drawn by one multi draw with the same program
+struct draw_run
+{
+    GLuint program;
+    u32 first_command;
+    u32 command_count;
+};
+
+// NOTE: commands and instances of a pass, built every frame in the transient arena.
+//       They're uploaded once and every run is a multi draw of its range of commands
+struct draw_list
+{
+    u32 command_count;
+    u32 instance_count;
+    u32 run_count;
+    draw_command *command_list;
+    draw_instance *instance_list;
+    draw_run *run_list;
+};
+
+// NOTE: gpu side of a draw_list, the buffers are orphaned on every upload
+//       so the driver never waits for the previous frame to be done with them
+struct draw_buffer
+{
+    GLuint command_buffer;
+    GLuint instance_buffer;
+};
+
+draw_buffer DrawBuffer(void)
+{
+    draw_buffer result;
+    glGenBuffers(1, &result.command_buffer);
+    glGenBuffers(1, &result.instance_buffer);
+
+    return(result);
+}
+
+void BeginDrawList(draw_list *list, u32 max_command_count, u32 max_instance_count, memory_arena *transient_arena)
+{
+    list->command_count = 0;
+    list->instance_count = 0;
+    list->run_count = 0;
+    list->command_list = PushArray(transient_arena, max_command_count, draw_command);
+    list->instance_list = PushArray(transient_arena, max_instance_count, draw_instance);
+    list->run_list = PushArray(transient_arena, max_command_count, draw_run);
+}
+
+// NOTE: the draws pushed after this are drawn with program
+void BeginDrawRun(draw_list *list, GLuint program)
+{
+    draw_run *run = &list->run_list[list->run_count++];
+    run->program = program;
+    run->first_command = list->command_count;
+    run->command_count = 0;
+}
+
+// NOTE: one instance of the mesh per entry of instance_list
+void PushDraw(draw_list *list, mesh_data *mesh, draw_instance *instance_list, u32 instance_count)
+{
+    Assert(list->run_count > 0);
+    list->run_list[list->run_count - 1].command_count++;
+    draw_command *command = &list->command_list[list->command_count];
+    command->index_count = mesh->index_count;
+    command->instance_count = instance_count;
+    command->first_index = mesh->first_index;
+    command->base_vertex = mesh->base_vertex;
+    command->base_instance = list->instance_count;
+    list->command_count++;
+    memcpy(&list->instance_list[list->instance_count], instance_list, instance_count * sizeof(draw_instance));
+    list->instance_count += instance_count;
+}
+
+void SubmitDrawList(draw_list *list, draw_buffer *buffer)
+{
+    if(list->command_count == 0)
+    {
+        return;
+    }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer->command_buffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, (u64)list->command_count * sizeof(draw_command),
+                 list->command_list, GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer->instance_buffer);
+    glBufferData(GL_ARRAY_BUFFER, (u64)list->instance_count * sizeof(draw_instance),
+                 list->instance_list, GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    BindMeshBufferInstances(&global_mesh_buffer, buffer->instance_buffer);
+    for(u32 run_index = 0; run_index < list->run_count; run_index++)
+    {
+        draw_run *run = &list->run_list[run_index];
+        if(run->command_count == 0)
+        {
+            continue;
+        }
+        GLUseProgram(run->program);
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void *)((u64)run->first_command * sizeof(draw_command)),
+                                    run->command_count, 0);
+    }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+u32 GetMeshCount(scene_node *node_list, u32 node_count)
+{
+    u32 result = 0;
+    for(u32 node_index = 0; node_index < node_count; node_index++)
+    {
+        result += (u32)node_list[node_index].mesh_list.size();
+    }
+
+    return(result);
+}
+
+// NOTE: nodes whose mesh lists have the same meshes in the same order and that use the
+//       same shader permutation, the meshes of the first node are drawn once for all of them
+struct node_group
+{
+    u32 node_count;
+    u32 *node_index_list;
+};
+
+struct node_group_list
+{
+    u32 count;
+    node_group *group_list;
+};
+
+// NOTE: what a draw of the mesh depends on, bounds are left out since
+//       meshes with the same range in the mesh buffer have the same ones
+INTERNAL u32 HashMeshList(std::vector<mesh_data> &mesh_list)
+{
+    u32 result = 2166136261u;
+    for(mesh_data &mesh : mesh_list)
+    {
+        u32 field_list[] = {mesh.vao, mesh.first_index, (u32)mesh.base_vertex, mesh.index_count,
+                            mesh.vertex_count, mesh.material_index};
+        result = HashBytes(field_list, sizeof(field_list), result);
+    }
+
+    return(result);
+}
+
+INTERNAL b32 AreMeshListsEqual(std::vector<mesh_data> &a, std::vector<mesh_data> &b)
+{
+    if(a.size() != b.size())
+    {
+        return(false);
+    }
+    for(u32 mesh_index = 0; mesh_index < a.size(); mesh_index++)
+    {
+        mesh_data *mesh_a = &a[mesh_index];
+        mesh_data *mesh_b = &b[mesh_index];
+        if((mesh_a->vao != mesh_b->vao) || (mesh_a->first_index != mesh_b->first_index) ||
+           (mesh_a->base_vertex != mesh_b->base_vertex) || (mesh_a->index_count != mesh_b->index_count) ||
+           (mesh_a->vertex_count != mesh_b->vertex_count) || (mesh_a->material_index != mesh_b->material_index))
+        {
+            return(false);
+        }
+    }
+
+    return(true);
+}
+
+// NOTE: open addressing table of the groups in the transient arena, rebuilt every frame.
+//       The groups keep the order of their first node and every group lists its nodes in order
+void GroupNodeInstances(node_group_list *groups, scene_node *node_list, u32 node_count,
+                        memory_arena *transient_arena)
+{
+    u32 slot_count = 1;
+    while(slot_count < 2 * node_count)
+    {
+        slot_count *= 2;
+    }
+    // NOTE: group index + 1, 0 is a free slot
+    u32 *slot_list = PushArray(transient_arena, slot_count, u32);
+    memset(slot_list, 0, slot_count * sizeof(u32));
+    u32 *node_group_index = PushArray(transient_arena, node_count, u32);
+    u32 *first_node_list = PushArray(transient_arena, node_count, u32);
+    groups->count = 0;
+    groups->group_list = PushArray(transient_arena, node_count, node_group);
+
+    for(u32 node_index = 0; node_index < node_count; node_index++)
+    {
+        scene_node *node = &node_list[node_index];
+        u32 slot = (HashMeshList(node->mesh_list) ^ node->gltf_model) & (slot_count - 1);
+        while(slot_list[slot])
+        {
+            scene_node *first_node = &node_list[first_node_list[slot_list[slot] - 1]];
+            if((first_node->gltf_model == node->gltf_model) &&
+               AreMeshListsEqual(first_node->mesh_list, node->mesh_list))
+            {
+                break;
+            }
+            slot = (slot + 1) & (slot_count - 1);
+        }
+        if(!slot_list[slot])
+        {
+            first_node_list[groups->count] = node_index;
+            groups->group_list[groups->count].node_count = 0;
+            slot_list[slot] = ++groups->count;
+        }
+        node_group_index[node_index] = slot_list[slot] - 1;
+        groups->group_list[slot_list[slot] - 1].node_count++;
+    }
+
+    u32 *node_index_list = PushArray(transient_arena, node_count, u32);
+    for(u32 group_index = 0; group_index < groups->count; group_index++)
+    {
+        node_group *group = &groups->group_list[group_index];
+        group->node_index_list = node_index_list;
+        node_index_list += group->node_count;
+        group->node_count = 0;
+    }
+    for(u32 node_index = 0; node_index < node_count; node_index++)
+    {
+        node_group *group = &groups->group_list[node_group_index[node_index]];
+        group->node_index_list[group->node_count++] = node_index;
+    }
+}
+
+// NOTE: every draw of the frame goes through the render queue with a sort key, from the
+//       most to the least significant bits: pass | shader | vao | material | depth.
+//       After sorting the commands of a pass are contiguous and grouped by state, so the
+//       state only changes between runs and the draws of a run are in front to back order
+#define RENDER_KEY_DEPTH_BITS 24
+#define RENDER_KEY_MATERIAL_BITS 20
+#define RENDER_KEY_VAO_BITS 8
+#define RENDER_KEY_SHADER_BITS 8
+#define RENDER_KEY_PASS_BITS 4
+
+#define RENDER_KEY_DEPTH_SHIFT 0
+#define RENDER_KEY_MATERIAL_SHIFT (RENDER_KEY_DEPTH_SHIFT + RENDER_KEY_DEPTH_BITS)
+#define RENDER_KEY_VAO_SHIFT (RENDER_KEY_MATERIAL_SHIFT + RENDER_KEY_MATERIAL_BITS)
+#define RENDER_KEY_SHADER_SHIFT (RENDER_KEY_VAO_SHIFT + RENDER_KEY_VAO_BITS)
+#define RENDER_KEY_PASS_SHIFT (RENDER_KEY_SHADER_SHIFT + RENDER_KEY_SHADER_BITS)
+
+static_assert(RENDER_KEY_PASS_SHIFT + RENDER_KEY_PASS_BITS == 64, "render key must use all 64 bits");
+
+inline u32 GetRenderKeyField(u64 key, u32 shift, u32 bit_count)
+{
+    u32 result = (u32)((key >> shift) & ((1ull << bit_count) - 1));
+
+    return(result);
+}
+
+enum render_pass
+{
+    RenderPass_Shadow,
+    RenderPass_Depth,
+    RenderPass_Opaque,
+
+    RenderPass_Count,
+};
+
+// NOTE: the instances are a range of the instance list of the queue
+struct render_command
+{
+    u64 key;
+    mesh_data *mesh;
+    u32 first_instance;
+    u32 instance_count;
+};
+
+// NOTE: state changes between consecutive commands of the same pass,
+//       i.e. the binds a draw per command would issue in that order
+struct render_queue_stats
+{
+    u32 command_count;
+    u32 shader_changes;
+    u32 vao_changes;
+    u32 material_changes;
+};
+
+// NOTE: programs and vaos are stored in the key by the index they were registered with,
+//       the tables outlive the frame so the indices are stable. The commands live in the
+//       transient arena and are rebuilt every frame
+struct render_queue
+{
+    u32 shader_count;
+    GLuint shader_list[1 << RENDER_KEY_SHADER_BITS];
+    u32 vao_count;
+    GLuint vao_list[1 << RENDER_KEY_VAO_BITS];
+
+    u32 command_count;
+    u32 command_capacity;
+    render_command *command_list;
+    u32 instance_count;
+    u32 instance_capacity;
+    draw_instance *instance_list;
+
+    render_queue_stats unsorted_stats;
+    render_queue_stats sorted_stats;
+};
+
+// NOTE: where depth is measured from, commands are sorted by their distance along direction
+struct render_view
+{
+    vec3 origin;
+    vec3 direction;
+    f32 depth_range;
+};
+
+INTERNAL u32 GetRenderStateIndex(GLuint *id_list, u32 *count, u32 max_count, GLuint id)
+{
+    for(u32 index = 0; index < *count; index++)
+    {
+        if(id_list[index] == id)
+        {
+            return(index);
+        }
+    }
+    Assert(*count < max_count);
+    id_list[*count] = id;
+
+    return((*count)++);
+}
+
+u64 RenderKey(render_queue *queue, u32 pass, GLuint program, GLuint vao, u32 material_index, f32 depth)
+{
+    u32 shader_index = GetRenderStateIndex(queue->shader_list, &queue->shader_count,
+                                           ArrayCount(queue->shader_list), program);
+    u32 vao_index = GetRenderStateIndex(queue->vao_list, &queue->vao_count, ArrayCount(queue->vao_list), vao);
+    Assert(pass < (1u << RENDER_KEY_PASS_BITS));
+    Assert(material_index < (1u << RENDER_KEY_MATERIAL_BITS));
+    u32 max_depth = (1u << RENDER_KEY_DEPTH_BITS) - 1;
+    u32 quantized_depth = (u32)(Clamp(depth, 0.0f, 1.0f) * (f32)max_depth);
+
+    u64 result = ((u64)pass << RENDER_KEY_PASS_SHIFT) |
+                 ((u64)shader_index << RENDER_KEY_SHADER_SHIFT) |
+                 ((u64)vao_index << RENDER_KEY_VAO_SHIFT) |
+                 ((u64)material_index << RENDER_KEY_MATERIAL_SHIFT) |
+                 ((u64)quantized_depth << RENDER_KEY_DEPTH_SHIFT);
+
+    return(result);
+}
+
+// NOTE: normalized distance of the bounds center along the view direction
+inline f32 GetRenderDepth(render_view *view, rect3 world_bounds)
+{
+    f32 distance = DotProduct(GetRectangleCenter(world_bounds) - view->origin, view->direction);
+    f32 result = distance / view->depth_range;
+
+    return(result);
+}
+
+void BeginRenderQueue(render_queue *queue, u32 max_command_count, u32 max_instance_count,
+                      memory_arena *transient_arena)
+{
+    queue->command_count = 0;
+    queue->command_capacity = max_command_count;
+    queue->command_list = PushArray(transient_arena, max_command_count, render_command);
+    queue->instance_count = 0;
+    queue->instance_capacity = max_instance_count;
+    queue->instance_list = PushArray(transient_arena, max_instance_count, draw_instance);
+}
+
+inline void PushRenderInstance(render_queue *queue, u32 object_index, u32 parameter)
+{
+    Assert(queue->instance_count < queue->instance_capacity);
+    queue->instance_list[queue->instance_count++] = {object_index, parameter};
+}
+
+// NOTE: the command draws every instance pushed since first_instance
+void PushRenderCommand(render_queue *queue, u64 key, mesh_data *mesh, u32 first_instance)
+{
+    Assert(queue->command_count < queue->command_capacity);
+    render_command *command = &queue->command_list[queue->command_count++];
+    command->key = key;
+    command->mesh = mesh;
+    command->first_instance = first_instance;
+    command->instance_count = queue->instance_count - first_instance;
+}
+
+render_queue_stats CountStateChanges(render_queue *queue)
+{
+    render_queue_stats result = {};
+    result.command_count = queue->command_count;
+    for(u32 i = 0; i < queue->command_count; i++)
+    {
+        u64 key = queue->command_list[i].key;
+        u64 previous_key = (i > 0) ? queue->command_list[i - 1].key : 0;
+        b32 is_new_pass = (i == 0) || (GetRenderKeyField(key, RENDER_KEY_PASS_SHIFT, RENDER_KEY_PASS_BITS) !=
+                                       GetRenderKeyField(previous_key, RENDER_KEY_PASS_SHIFT, RENDER_KEY_PASS_BITS));
+        if(is_new_pass || (GetRenderKeyField(key, RENDER_KEY_SHADER_SHIFT, RENDER_KEY_SHADER_BITS) !=
+                           GetRenderKeyField(previous_key, RENDER_KEY_SHADER_SHIFT, RENDER_KEY_SHADER_BITS)))
+        {
+            result.shader_changes++;
+        }
+        if(is_new_pass || (GetRenderKeyField(key, RENDER_KEY_VAO_SHIFT, RENDER_KEY_VAO_BITS) !=
+                           GetRenderKeyField(previous_key, RENDER_KEY_VAO_SHIFT, RENDER_KEY_VAO_BITS)))
+        {
+            result.vao_changes++;
+        }
+        if(is_new_pass || (GetRenderKeyField(key, RENDER_KEY_MATERIAL_SHIFT, RENDER_KEY_MATERIAL_BITS) !=
+                           GetRenderKeyField(previous_key, RENDER_KEY_MATERIAL_SHIFT, RENDER_KEY_MATERIAL_BITS)))
+        {
+            result.material_changes++;
+        }
+    }
+
+    return(result);
+}
+
+// NOTE: LSD radix sort on the key, 8 bits per pass. It's stable so commands with the same
+//       key stay in push order. Digits that are the same for every key are skipped,
+//       which with few passes and shaders is most of the high bits
+void SortRenderQueue(render_queue *queue, memory_arena *transient_arena)
+{
+    queue->unsorted_stats = CountStateChanges(queue);
+
+    u32 count = queue->command_count;
+    if(count > 1)
+    {
+        render_command *source = queue->command_list;
+        render_command *dest = PushArray(transient_arena, count, render_command);
+        for(u32 shift = 0; shift < 64; shift += 8)
+        {
+            u32 offset_list[256] = {};
+            for(u32 i = 0; i < count; i++)
+            {
+                offset_list[(source[i].key >> shift) & 0xFF]++;
+            }
+            if(offset_list[(source[0].key >> shift) & 0xFF] == count)
+            {
+                continue;
+            }
+
+            u32 offset = 0;
+            for(u32 digit = 0; digit < 256; digit++)
+            {
+                u32 digit_count = offset_list[digit];
+                offset_list[digit] = offset;
+                offset += digit_count;
+            }
+            for(u32 i = 0; i < count; i++)
+            {
+                dest[offset_list[(source[i].key >> shift) & 0xFF]++] = source[i];
+            }
+
+            render_command *temp = source;
+            source = dest;
+            dest = temp;
+        }
+        queue->command_list = source;
+    }
+
+    queue->sorted_stats = CountStateChanges(queue);
+}
+
+// NOTE: the queue must be sorted. Every run of commands with the same shader, vao and
+//       material is a single multi draw, the program is switched between runs.
+//       material_index comes from a per instance attribute and GLSL only treats a value
+//       as dynamically uniform over a whole multi draw, so the material arrays and
+//       bindless handles can only be indexed with it if a run never mixes materials.
+//       Everything else the pass needs must already be bound
+void SubmitRenderPass(render_queue *queue, u32 pass, draw_buffer *buffer, memory_arena *transient_arena)
+{
+    u32 first = 0;
+    while((first < queue->command_count) &&
+          (GetRenderKeyField(queue->command_list[first].key, RENDER_KEY_PASS_SHIFT, RENDER_KEY_PASS_BITS) != pass))
+    {
+        first++;
+    }
+
+    draw_list list;
+    BeginDrawList(&list, queue->command_count, queue->instance_count, transient_arena);
+    u32 state_bit_count = RENDER_KEY_PASS_BITS + RENDER_KEY_SHADER_BITS + RENDER_KEY_VAO_BITS +
+                          RENDER_KEY_MATERIAL_BITS;
+    u32 state_shift = 64 - state_bit_count;
+    u64 run_state = 0;
+    for(u32 i = first; i < queue->command_count; i++)
+    {
+        render_command *command = &queue->command_list[i];
+        if(GetRenderKeyField(command->key, RENDER_KEY_PASS_SHIFT, RENDER_KEY_PASS_BITS) != pass)
+        {
+            break;
+        }
+        u64 state = command->key >> state_shift;
+        if((list.run_count == 0) || (state != run_state))
+        {
+            run_state = state;
+            u32 shader_index = GetRenderKeyField(command->key, RENDER_KEY_SHADER_SHIFT, RENDER_KEY_SHADER_BITS);
+            u32 vao_index = GetRenderKeyField(command->key, RENDER_KEY_VAO_SHIFT, RENDER_KEY_VAO_BITS);
+            // NOTE: only meshes in the mesh buffer can be part of a multi draw
+            Assert(queue->vao_list[vao_index] == global_mesh_buffer.vao);
+            BeginDrawRun(&list, queue->shader_list[shader_index]);
+        }
+        PushDraw(&list, command->mesh, &queue->instance_list[command->first_instance], command->instance_count);
+    }
+    SubmitDrawList(&list, buffer);
+}
+
+// NOTE: casters are only drawn in the cascades whose light space volume they overlap,
+//       the geometry shader skips the layers that are not in the cascade mask of the instance.
+//       Near and far aren't tested since depth clamping keeps casters in front of
+//       the near plane and anything past the far plane can't shadow the cascade
+//       With instanced_layers every node gets one instance per overlapped cascade
+//       with only that cascade in the mask and the vertex shader picks the layer from it.
+//       A mesh of a group is one command with the visible nodes of the group as instances
+void PushShadowCasterList(render_queue *queue, GLuint program, render_view *view, scene_node *node_list,
+                          node_group_list *groups, node_transforms *transforms,
+                          frustum_planes *cascade_frustums, u32 cascade_count, b32 instanced_layers)
+{
+    Assert(cascade_count <= 32);
+    for(u32 group_index = 0; group_index < groups->count; group_index++)
+    {
+        node_group *group = &groups->group_list[group_index];
+        scene_node *first_node = &node_list[group->node_index_list[0]];
+        for(mesh_data &mesh : first_node->mesh_list)
+        {
+            u32 first_instance = queue->instance_count;
+            f32 depth = FLT_MAX;
+            for(u32 i = 0; i < group->node_count; i++)
+            {
+                u32 node_index = group->node_index_list[i];
+                Assert(node_index < transforms->count);
+                rect3 world_bounds = TransformRect3(transforms->model_list[node_index], mesh.bounds);
+                u32 mask = 0;
+                for(u32 cascade_index = 0; cascade_index < cascade_count; cascade_index++)
+                {
+                    if(IsRectInFrustum(&cascade_frustums[cascade_index], world_bounds, 4))
+                    {
+                        mask |= (1 << cascade_index);
+                    }
+                }
+                if(mask == 0)
+                {
+                    continue;
+                }
+                depth = Minimum(depth, GetRenderDepth(view, world_bounds));
+                if(instanced_layers)
+                {
+                    for(u32 cascade_index = 0; cascade_index < cascade_count; cascade_index++)
+                    {
+                        if(mask & (1 << cascade_index))
+                        {
+                            PushRenderInstance(queue, node_index, 1 << cascade_index);
+                        }
+                    }
+                }
+                else
+                {
+                    PushRenderInstance(queue, node_index, mask);
+                }
+            }
+            if(queue->instance_count > first_instance)
+            {
+                // NOTE: materials don't matter for depth only rendering
+                u64 key = RenderKey(queue, RenderPass_Shadow, program, mesh.vao, 0, depth);
+                PushRenderCommand(queue, key, &mesh, first_instance);
+            }
+        }
+    }
+}
+
+// NOTE: meshes whose world space bounds are outside the frustum are skipped,
+//       pass a NULL frustum to push everything. A mesh of a group is one command
+//       with the visible nodes of the group as instances, sorted by the nearest one.
+//       The permutation of the pbr shader is picked per group. With depth_shaders
+//       every command is pushed to the depth pass too, with the same instances,
+//       and the color pass permutation leaves the alpha test to it
+void PushNodeList(render_queue *queue, shader_permutations *pbr_shaders, shader_permutations *depth_shaders,
+                  render_view *view, scene_node *node_list, node_group_list *groups,
+                  node_transforms *transforms, frustum_planes *frustum)
+{
+    for(u32 group_index = 0; group_index < groups->count; group_index++)
+    {
+        node_group *group = &groups->group_list[group_index];
+        scene_node *first_node = &node_list[group->node_index_list[0]];
+        u32 option_values[] = {first_node->gltf_model ? 1u : 0u, depth_shaders ? 0u : 1u};
+        GLuint program = GetShaderPermutation(pbr_shaders, option_values)->id;
+        for(mesh_data &mesh : first_node->mesh_list)
+        {
+            u32 first_instance = queue->instance_count;
+            f32 depth = FLT_MAX;
+            for(u32 i = 0; i < group->node_count; i++)
+            {
+                u32 node_index = group->node_index_list[i];
+                Assert(node_index < transforms->count);
+                rect3 world_bounds = TransformRect3(transforms->model_list[node_index], mesh.bounds);
+                if(frustum && !IsRectInFrustum(frustum, world_bounds))
+                {
+                    continue;
+                }
+                depth = Minimum(depth, GetRenderDepth(view, world_bounds));
+                PushRenderInstance(queue, node_index, mesh.material_index);
+            }
+            if(queue->instance_count > first_instance)
+            {
+                u64 key = RenderKey(queue, RenderPass_Opaque, program, mesh.vao, mesh.material_index, depth);
+                PushRenderCommand(queue, key, &mesh, first_instance);
+                if(depth_shaders)
+                {
+                    // NOTE: like the shadow pass the material only matters for the alpha test
+                    u32 alpha_test = IsMaterialAlphaTested(&global_material_system, mesh.material_index);
+                    GLuint depth_program = GetShaderPermutation(depth_shaders, &alpha_test)->id;
+                    key = RenderKey(queue, RenderPass_Depth, depth_program, mesh.vao,
+                                    alpha_test ? mesh.material_index : 0, depth);
+                    PushRenderCommand(queue, key, &mesh, first_instance);
+                }
+            }
         }
     }
 }
@@ -390,11 +1127,23 @@ struct bloom_mip
     vec2 screen_size;
 };
 
-int main(void)
+int main(i32 argc, char **argv)
 {
+    for(i32 arg_index = 1; arg_index < argc; arg_index++)
+    {
+        if(strcmp(argv[arg_index], "-deferred") == 0)
+        {
+            deferred_shading = true;
+        }
+        else if((strcmp(argv[arg_index], "-lights") == 0) && (arg_index + 1 < argc))
+        {
+            random_light_count = (u32)atoi(argv[++arg_index]);
+        }
+    }
+
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
     GLFWwindow *window = glfwCreateWindow(default_window_width, default_window_height, "hello!", NULL, NULL);
@@ -407,14 +1156,14 @@ int main(void)
     {
         return(1);
     }
-    glViewport(0, 0, default_window_width, default_window_height);
+    GLViewport(0, 0, default_window_width, default_window_height);
 
     glfwSwapInterval(0);
     glfwSetFramebufferSizeCallback(window, ResizeCallback);
     glfwSetCursorPosCallback(window, MouseCallback);
     glfwSetScrollCallback(window, ScrollCallback);
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_HIDDEN);
-    glEnable(GL_DEPTH_TEST);
+    GLEnable(GL_DEPTH_TEST);
 
     state.is_running = true;
     state.window_width = default_window_width;
@@ -423,14 +1172,18 @@ int main(void)
     state.delta_time = 0.0f;
     state.window = window;
     state.player_camera = DefaultCamera();
+    if(!InitializeGameMemory(&state.memory))
+    {
+        return(1);
+    }
     mouse_last_movement = Vec2(state.window_width / 2.0f, state.window_height / 2.0f);
 
     GLuint render_fbo, render_fbo_texture, render_fbo_depth_stencil;
     glGenFramebuffers(1, &render_fbo);
-    glBindFramebuffer(GL_FRAMEBUFFER, render_fbo);
+    GLBindFramebuffer(GL_FRAMEBUFFER, render_fbo);
     
     glGenTextures(1, &render_fbo_texture);
-    glBindTexture(GL_TEXTURE_2D, render_fbo_texture);
+    GLBindTexture(GL_TEXTURE_2D, render_fbo_texture);
     // TODO: framebuffer size is not updated with window resizing
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, state.window_width, state.window_height, 0, GL_RGBA, GL_FLOAT, NULL);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -453,7 +1206,7 @@ int main(void)
     GLuint light_fbo, light_depth_maps;
     glGenFramebuffers(1, &light_fbo);
     glGenTextures(1, &light_depth_maps);
-    glBindTexture(GL_TEXTURE_2D_ARRAY, light_depth_maps);
+    GLBindTexture(GL_TEXTURE_2D_ARRAY, light_depth_maps);
     glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT32F,
                     depth_map_resolution, depth_map_resolution, SHADOW_CASCADES_COUNT, 
                     0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
@@ -464,7 +1217,7 @@ int main(void)
     vec4 border_color = Vec4(1.0f);
     glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, &border_color.e[0]);
     
-    glBindFramebuffer(GL_FRAMEBUFFER, light_fbo);
+    GLBindFramebuffer(GL_FRAMEBUFFER, light_fbo);
     glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, light_depth_maps, 0);
     glDrawBuffer(GL_NONE);
     glReadBuffer(GL_NONE);
@@ -473,12 +1226,24 @@ int main(void)
         Assert("framebuffer incomplete");
     }
 
-    GLuint matrices_ubo;
-    glGenBuffers(1, &matrices_ubo);
-    glBindBuffer(GL_UNIFORM_BUFFER, matrices_ubo);
-    glBufferData(GL_UNIFORM_BUFFER, sizeof(mat4x4) * SHADOW_CASCADES_COUNT, NULL, GL_STATIC_DRAW);
-    glBindBufferBase(GL_UNIFORM_BUFFER, 0, matrices_ubo);
-    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    // NOTE: the g-buffer has its own depth, copied to the hdr framebuffer after lighting
+    g_buffer gbuffer = {};
+    if(deferred_shading)
+    {
+        gbuffer = GBuffer(state.window_width, state.window_height);
+    }
+#if POST_PROCESSING_ENABLED
+    GLuint scene_fbo = render_fbo;
+#else
+    GLuint scene_fbo = 0;
+#endif
+
+    GLuint matrices_ubo = UniformBuffer(sizeof(mat4x4) * SHADOW_CASCADES_COUNT, LIGHT_SPACE_MATRICES_UBO_BINDING);
+    GLuint frame_ubo = UniformBuffer(sizeof(frame_uniforms), FRAME_UBO_BINDING);
+    light_clusters clusters = LightClusters();
+    object_buffer render_list_objects = ObjectBuffer();
+    draw_buffer shadow_draw_buffer = DrawBuffer();
+    draw_buffer scene_draw_buffer = DrawBuffer();
 
     // NOTE: abritrary values based on the sponza scene
     // TODO: consider changing them at run time
@@ -503,7 +1268,7 @@ int main(void)
         mip_size *= 0.5f;
         bloom_mip_list[mip_index].screen_size = mip_size;
         glGenTextures(1, &(bloom_mip_list[mip_index].texture_id));
-        glBindTexture(GL_TEXTURE_2D, bloom_mip_list[mip_index].texture_id);
+        GLBindTexture(GL_TEXTURE_2D, bloom_mip_list[mip_index].texture_id);
         glTexImage2D(GL_TEXTURE_2D, 0, GL_R11F_G11F_B10F, (i32) mip_size.x, (i32) mip_size.y,
                      0, GL_RGB, GL_FLOAT, NULL);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -513,7 +1278,7 @@ int main(void)
     }
     GLuint bloom_fbo;
     glGenFramebuffers(1, &bloom_fbo);
-    glBindFramebuffer(GL_FRAMEBUFFER, bloom_fbo);
+    GLBindFramebuffer(GL_FRAMEBUFFER, bloom_fbo);
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, bloom_mip_list[0].texture_id, 0);
     u32 bloom_fbo_attachments[1] = {GL_COLOR_ATTACHMENT0};
     glDrawBuffers(1, bloom_fbo_attachments);
@@ -522,12 +1287,12 @@ int main(void)
         Assert("framebuffer incomplete");
     }
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    GLBindFramebuffer(GL_FRAMEBUFFER, 0);
 
     GLuint quad_vao, quad_vbo;
     glGenVertexArrays(1, &quad_vao);
     glGenBuffers(1, &quad_vbo);
-    glBindVertexArray(quad_vao);
+    GLBindVertexArray(quad_vao);
     glBindBuffer(GL_ARRAY_BUFFER, quad_vbo);
     glBufferData(GL_ARRAY_BUFFER, sizeof(QUAD_VERTICES), &QUAD_VERTICES[0], GL_STATIC_DRAW);
     glEnableVertexAttribArray(0);
@@ -538,7 +1303,7 @@ int main(void)
     GLuint screen_quad_vao, screen_quad_vbo;
     glGenVertexArrays(1, &screen_quad_vao);
     glGenBuffers(1, &screen_quad_vbo);
-    glBindVertexArray(screen_quad_vao);
+    GLBindVertexArray(screen_quad_vao);
     glBindBuffer(GL_ARRAY_BUFFER, screen_quad_vbo);
     glBufferData(GL_ARRAY_BUFFER, sizeof(SCREEN_QUAD_VERTICES), &SCREEN_QUAD_VERTICES[0], GL_STATIC_DRAW);
     glEnableVertexAttribArray(0);
@@ -546,13 +1311,60 @@ int main(void)
     glEnableVertexAttribArray(1);
     glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(f32), (void *)(2 * sizeof(f32)));
 
-    ShaderProgram pbr_shader = ShaderProgram("src/shaders/vs.glsl", "src/shaders/pbr.fs.glsl");
-    ShaderProgram light_shader = ShaderProgram("src/shaders/lighting.vs.glsl", "src/shaders/lighting.fs.glsl");
+    InitializeMaterialSystem(&global_material_system, HasGLExtension("GL_ARB_bindless_texture"),
+                             (GLADloadproc)glfwGetProcAddress);
+    char shader_defines[64];
+    snprintf(shader_defines, sizeof(shader_defines), "#define CASCADE_COUNT %d\n", SHADOW_CASCADES_COUNT);
+    char pbr_shader_defines[512];
+    snprintf(pbr_shader_defines, sizeof(pbr_shader_defines), 
+             "%s#define MATERIAL_BINDLESS %d\n#define MAX_MATERIAL_ARRAYS %d\n#define MATERIAL_ARRAY_FIRST_UNIT %d\n"
+             "#define CLUSTER_GRID_X %d\n#define CLUSTER_GRID_Y %d\n#define CLUSTER_GRID_Z %d\n",
+             shader_defines, global_material_system.bindless, MAX_MATERIAL_ARRAYS, MATERIAL_ARRAY_FIRST_UNIT,
+             CLUSTER_GRID_X, CLUSTER_GRID_Y, CLUSTER_GRID_Z);
+    shader_option pbr_options[] = {{"USE_METALLIC_ROUGHNESS", 2}, {"ALPHA_TEST", 2}};
+    shader_permutations pbr_shaders;
+    InitializeShaderPermutations(&pbr_shaders, "src/shaders/vs.glsl", "src/shaders/pbr.fs.glsl", NULL,
+                                 pbr_shader_defines, pbr_options, ArrayCount(pbr_options));
+    shader_option depth_prepass_options[] = {{"ALPHA_TEST", 2}};
+    shader_permutations depth_prepass_shaders;
+    InitializeShaderPermutations(&depth_prepass_shaders, "src/shaders/vs.glsl", "src/shaders/depth_prepass.fs.glsl",
+                                 NULL, pbr_shader_defines, depth_prepass_options, ArrayCount(depth_prepass_options));
+    // NOTE: the g-buffer shaders take the same options so PushNodeList doesn't care about the mode
+    shader_permutations gbuffer_shaders;
+    ShaderProgram *deferred_lighting_shader = NULL;
+    if(deferred_shading)
+    {
+        InitializeShaderPermutations(&gbuffer_shaders, "src/shaders/vs.glsl", "src/shaders/gbuffer.fs.glsl", NULL,
+                                     pbr_shader_defines, pbr_options, ArrayCount(pbr_options));
+        deferred_lighting_shader = new ShaderProgram("src/shaders/sampler.vs.glsl",
+                                                     "src/shaders/deferred_lighting.fs.glsl", NULL,
+                                                     pbr_shader_defines);
+    }
+    ShaderProgram light_shader = ShaderProgram("src/shaders/lighting.vs.glsl", "src/shaders/lighting.fs.glsl", 
+                                               NULL, shader_defines);
     ShaderProgram skybox_shader("src/shaders/skybox_vs.glsl", "src/shaders/skybox_fs.glsl");
     ShaderProgram shadow_shader("src/shaders/shadow_map.vs.glsl", "src/shaders/shadow_map.fs.glsl", 
-                                "src/shaders/shadow_map.gs.glsl");
+                                "src/shaders/shadow_map.gs.glsl", shader_defines);
+    shadow_layered_instancing_supported = (HasGLExtension("GL_ARB_shader_viewport_layer_array") ||
+                                           HasGLExtension("GL_AMD_vertex_shader_layer"));
+    ShaderProgram *shadow_layered_shader = NULL;
+    if(shadow_layered_instancing_supported)
+    {
+        shadow_layered_shader = new ShaderProgram("src/shaders/shadow_map_layered.vs.glsl", 
+                                                  "src/shaders/shadow_map.fs.glsl", NULL, shader_defines);
+    }
+    // NOTE: with the pre-pass on, the opaque pass plus the pre-pass is what to compare against
+    //       the opaque pass alone with it off
+    gpu_profiler profiler = GPUProfiler();
+    f64 report_frame_time = 0.0;
+    b32 last_use_layered_shadows = false;
+    b32 last_depth_prepass = depth_prepass;
     ShaderProgram debug_quad_shader("src/shaders/debug_quad.vs.glsl", "src/shaders/debug_quad.fs.glsl");
-    ShaderProgram postprocessing_shader("src/shaders/postprocessing.vs.glsl", "src/shaders/postprocessing.fs.glsl");
+    shader_option postprocessing_options[] = {{"BLOOM_ENABLED", 2}, {"TONEMAPPER", 3}};
+    shader_permutations postprocessing_shaders;
+    InitializeShaderPermutations(&postprocessing_shaders, "src/shaders/postprocessing.vs.glsl",
+                                 "src/shaders/postprocessing.fs.glsl", NULL, NULL,
+                                 postprocessing_options, ArrayCount(postprocessing_options));
     ShaderProgram downsampler_shader("src/shaders/sampler.vs.glsl", "src/shaders/downsampler.fs.glsl");
     ShaderProgram upsampler_shader("src/shaders/sampler.vs.glsl", "src/shaders/upsampler.fs.glsl");
 
@@ -566,59 +1378,87 @@ int main(void)
         "skybox/back.jpg",
     };
     GLuint skybox_cubemap = LoadCubemap(cubemap_faces, ArrayCount(cubemap_faces));
+    // NOTE: one core is left to the main thread, that keeps creating the
+    //       gl objects and uploading the decoded textures, hardware_concurrency can be 0
+    u32 core_count = std::thread::hardware_concurrency();
+    texture_compression_s3tc_supported = HasGLExtension("GL_EXT_texture_compression_s3tc");
+    StartTextureLoader(Maximum(core_count, 2u) - 1);
     GLuint black_texture = LoadTexture(TEXTURE_DEFAULT_BLACK);
     GLuint white_texture = LoadTexture(TEXTURE_DEFAULT_WHITE); 
     GLuint default_normal_texture = LoadTexture(TEXTURE_DEFAULT_NORMAL_MAP);
-    GLuint wood_diffuse = LoadTexture("wood.png");
+    GLuint wood_diffuse = LoadTexture("wood.png", TEXTURE_DEFAULT_WHITE);
     pbr_texture_group wood_textures =
     {
         wood_diffuse, default_normal_texture,
         black_texture, black_texture, white_texture,
     };
     pbr_texture_group rusted_iron_textures;
-    rusted_iron_textures.albedo = LoadTexture("rusted_iron/albedo.png");
-    rusted_iron_textures.normal = LoadTexture("rusted_iron/normal.png");
-    rusted_iron_textures.metallic = LoadTexture("rusted_iron/metallic.png");
-    rusted_iron_textures.roughness = LoadTexture("rusted_iron/roughness.png");
+    rusted_iron_textures.albedo = LoadTexture("rusted_iron/albedo.png", TEXTURE_DEFAULT_WHITE);
+    rusted_iron_textures.normal = LoadTexture("rusted_iron/normal.png", TEXTURE_DEFAULT_NORMAL_MAP);
+    rusted_iron_textures.metallic = LoadTexture("rusted_iron/metallic.png", TEXTURE_DEFAULT_BLACK);
+    rusted_iron_textures.roughness = LoadTexture("rusted_iron/roughness.png", TEXTURE_DEFAULT_BLACK);
     rusted_iron_textures.ao = white_texture;
 
     mesh_data sky_mesh = MeshDataUntextured(sizeof(SKYBOX_VERTICES) / (sizeof(f32) * 3), &SKYBOX_VERTICES[0]);
     mesh_data plane_mesh = MeshData(sizeof(PLANE_VERTICES) / (sizeof(f32) * 8), &PLANE_VERTICES[0]);
-    plane_mesh.textures = wood_textures;
+    plane_mesh.material_index = AddMaterial(&global_material_system, wood_textures);
 
-    mesh_data light_mesh = MeshDataUntextured(sizeof(LIGHT_CUBE_VERTICES) / (sizeof(f32) * 3), &LIGHT_CUBE_VERTICES[0]);
+    // NOTE: in the mesh buffer so all the light cubes are a single instanced draw
+    u32 light_cube_vertex_count = sizeof(LIGHT_CUBE_VERTICES) / (sizeof(f32) * 3);
+    std::vector<vertex_data> light_cube_vertices(light_cube_vertex_count);
+    for(u32 i = 0; i < light_cube_vertex_count; i++)
+    {
+        light_cube_vertices[i] = {};
+        light_cube_vertices[i].position = Vec3(LIGHT_CUBE_VERTICES[i * 3], LIGHT_CUBE_VERTICES[i * 3 + 1],
+                                               LIGHT_CUBE_VERTICES[i * 3 + 2]);
+    }
+    mesh_data light_mesh = MeshData(light_cube_vertex_count, light_cube_vertices.data());
+    draw_buffer light_draw_buffer = DrawBuffer();
     vec3 sun_position = Vec3(-4.0f, 100.0f, -4.0f);
     vec3 sun_direction = Normalize(sun_position);
     vec3 sun_intensity = Vec3(4000.0f);
-    point_light light_list[MAX_POINT_LIGHTS] =
+    // NOTE: the sun is lit separately with its shadow, these are only the point lights
+    std::vector<point_light> light_list =
     {
-        {Vec3(-0.5f, 2.5f, -0.5f), default_light_color},
-        {Vec3(-1.25f, 1.0f, -1.25f), default_light_color},
-        {Vec3(-2.0f, 0.5f, -1.75f), default_light_color},
-        {Vec3(1.75f, 1.0f, 1.0f), default_light_color},
-        {Vec3(1.5f, 1.5f, -1.625f), default_light_color},
-
-        // NOTE: keep sun as the last light in the array
-        {sun_position, sun_intensity},
+        {Vec3(-0.5f, 2.5f, -0.5f), default_light_color, default_light_radius},
+        {Vec3(-1.25f, 1.0f, -1.25f), default_light_color, default_light_radius},
+        {Vec3(-2.0f, 0.5f, -1.75f), default_light_color, default_light_radius},
+        {Vec3(1.75f, 1.0f, 1.0f), default_light_color, default_light_radius},
+        {Vec3(1.5f, 1.5f, -1.625f), default_light_color, default_light_radius},
     };
-    u32 light_count = 6;
 
     std::vector<mesh_data> sponza_mesh_list = std::vector<mesh_data>();
-    LoadModel(sponza_mesh_list, "sponza_khronos/Sponza.gltf");
+    LoadModel(sponza_mesh_list, "sponza_khronos/Sponza.gltf", &state.memory.scratch_arena);
     scene_node sponza_node = 
     {
         Vec3(0.0f, 0.0f, 0.0f), Identity(), Vec3(0.01f), sponza_mesh_list, 1,
     };
+    if(random_light_count > 0)
+    {
+        mat4x4 sponza_model = Translation(sponza_node.position) * sponza_node.rotation * Scaling(sponza_node.scale);
+        rect3 sponza_bounds = Rect3(Vec3(FLT_MAX), Vec3(-FLT_MAX));
+        for(u32 i = 0; i < sponza_mesh_list.size(); i++)
+        {
+            rect3 bounds = TransformRect3(sponza_model, sponza_mesh_list[i].bounds);
+            sponza_bounds.min = Vec3(Minimum(sponza_bounds.min.x, bounds.min.x),
+                                     Minimum(sponza_bounds.min.y, bounds.min.y),
+                                     Minimum(sponza_bounds.min.z, bounds.min.z));
+            sponza_bounds.max = Vec3(Maximum(sponza_bounds.max.x, bounds.max.x),
+                                     Maximum(sponza_bounds.max.y, bounds.max.y),
+                                     Maximum(sponza_bounds.max.z, bounds.max.z));
+        }
+        AddRandomLights(&light_list, random_light_count, sponza_bounds, default_light_color.x, RANDOM_LIGHT_RADIUS);
+    }
 
     std::vector<mesh_data> backpack_mesh_list = std::vector<mesh_data>();
-    LoadModel(backpack_mesh_list, "backpack/backpack.obj");
+    LoadModel(backpack_mesh_list, "backpack/backpack.obj", &state.memory.scratch_arena);
     scene_node backpack_node = 
     {
         Vec3(-0.5f, 0.5f, -2.0f), RotationY(DegreesToRadians(-45.0f)), Vec3(0.25f), backpack_mesh_list, 0,
     };
 
     mesh_data cube_mesh = MeshData(sizeof(CUBE_VERTICES_TEXTURED) / (sizeof(f32) * 8), &CUBE_VERTICES_TEXTURED[0]);
-    cube_mesh.textures = rusted_iron_textures;
+    cube_mesh.material_index = AddMaterial(&global_material_system, rusted_iron_textures);
     std::vector<mesh_data> cube_mesh_list = {cube_mesh};
     vec3 cube_positions[4] = 
     {
@@ -646,6 +1486,8 @@ int main(void)
         cube_nodes[0], cube_nodes[1], cube_nodes[2], cube_nodes[3],
     };
     u32 render_list_count = 7;
+    node_transforms render_list_transforms = {};
+    render_queue queue = {};
 
     while(state.is_running)
     {
@@ -653,7 +1495,11 @@ int main(void)
         state.delta_time = current_time - state.last_time;
         state.last_time = current_time;
 
+        ResetArena(&state.memory.transient_arena);
         ProcessInput(state.window);
+        u32 pending_texture_count = ProcessLoadedTextures(MAX_TEXTURE_UPLOADS_PER_FRAME);
+        UpdateMaterials(&global_material_system, pending_texture_count);
+        BeginGPUProfilerFrame(&profiler);
 
         // NOTE: this is just a silly thing i pulled out
         //       of my a** to simulate a day/night cycle
@@ -661,51 +1507,30 @@ int main(void)
         f32 day_time_sine = Sine(current_time / 10.0f);
         f32 day_time = Maximum((day_time_sine + 1.0f) / 2.0f, 0.01f);
         day_time *= day_time;
-        light_list[light_count - 1].color = Hadamard(Vec3(day_time), sun_intensity);
-        light_list[light_count - 1].position += Vec3(day_time_sine / 10.0f) * state.delta_time;
-        sun_direction = Normalize(light_list[light_count - 1].position);
+        vec3 sun_color = Hadamard(Vec3(day_time), sun_intensity);
+        sun_position += Vec3(day_time_sine / 10.0f) * state.delta_time;
+        sun_direction = Normalize(sun_position);
 
         // TODO: fix the function to rotate around a point
         render_list[2].rotation = render_list[2].rotation *
                                   RotationP(RotationY(DegreesToRadians(30) * state.delta_time), Vec3(0.0f, 0.0f, 0.0f)) *
                                   RotationZ(DegreesToRadians(15) * state.delta_time) * 
                                   RotationX(DegreesToRadians(45) * state.delta_time);
-
-        mat4x4 light_spaces_matrices[SHADOW_CASCADES_COUNT] =
-        {
-            Transpose(GetLightSpaceMatrix(sun_direction, state.window_width, state.window_height, 
-                                near_plane_cascades[0], far_plane_cascades[0])),
-            Transpose(GetLightSpaceMatrix(sun_direction, state.window_width, state.window_height, 
-                                near_plane_cascades[1], far_plane_cascades[1])),
-            Transpose(GetLightSpaceMatrix(sun_direction, state.window_width, state.window_height, 
-                                near_plane_cascades[2], far_plane_cascades[2])),
-        };
-        glBindBuffer(GL_UNIFORM_BUFFER, matrices_ubo);
-        for (u32 i = 0; i < ArrayCount(light_spaces_matrices); i++)
+        ComputeNodeTransforms(&render_list_transforms, render_list, render_list_count,
+                              &state.memory.transient_arena);
+        UploadObjectData(&render_list_objects, render_list, &render_list_transforms,
+                         &state.memory.transient_arena);
+
+        mat4x4 light_spaces_matrices[SHADOW_CASCADES_COUNT];
+        frustum_planes cascade_frustums[SHADOW_CASCADES_COUNT];
+        for(u32 i = 0; i < SHADOW_CASCADES_COUNT; i++)
         {
-            glBufferSubData(GL_UNIFORM_BUFFER, sizeof(mat4x4) * i, sizeof(mat4x4), &light_spaces_matrices[i]);
+            mat4x4 light_space_matrix = GetLightSpaceMatrix(sun_direction, state.window_width, state.window_height,
+                                                            near_plane_cascades[i], far_plane_cascades[i]);
+            cascade_frustums[i] = GetFrustumPlanes(light_space_matrix);
+            light_spaces_matrices[i] = Transpose(light_space_matrix);
         }
-        glBindBuffer(GL_UNIFORM_BUFFER, 0);
-
-        glEnable(GL_DEPTH_CLAMP);
-        glBindFramebuffer(GL_FRAMEBUFFER, light_fbo);
-        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glViewport(0, 0, depth_map_resolution, depth_map_resolution);
-        glClear(GL_DEPTH_BUFFER_BIT);
-        glCullFace(GL_FRONT);
-        shadow_shader.use();
-        RenderNodeList(&shadow_shader, render_list, render_list_count);
-        glCullFace(GL_BACK);
-
-#if POST_PROCESSING_ENABLED
-        glBindFramebuffer(GL_FRAMEBUFFER, render_fbo);
-#else
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-#endif
-        glViewport(0, 0, state.window_width, state.window_height);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glDisable(GL_DEPTH_CLAMP);
+        UploadUniformBuffer(matrices_ubo, &light_spaces_matrices[0], sizeof(light_spaces_matrices));
 
         mat4x4 perspective_projection = PerspectiveProjection(&state.player_camera, state.window_width, state.window_height);
         mat4x4 projection = perspective_projection;
@@ -721,153 +1546,282 @@ int main(void)
         }
         mat4x4 view = CameraViewMatrix(&state.player_camera);
         mat4x4 projection_mul_view = projection * view;
+        frustum_planes camera_frustum = GetFrustumPlanes(projection_mul_view);
+
+        b32 use_layered_shadows = shadow_layered_instancing_supported && shadow_layered_instancing;
+        ShaderProgram *current_shadow_shader = use_layered_shadows ? shadow_layered_shader : &shadow_shader;
+        // NOTE: casters are sorted front to back from the sun, the scene from the camera
+        f32 camera_far_plane = state.player_camera.settings.far_plane;
+        render_view shadow_view = {state.player_camera.position + sun_direction * camera_far_plane,
+                                   -sun_direction, 2.0f * camera_far_plane};
+        render_view camera_view = {state.player_camera.position, state.player_camera.front, camera_far_plane};
+        // NOTE: nodes that share their meshes are drawn instanced in both passes
+        node_group_list render_list_groups;
+        GroupNodeInstances(&render_list_groups, render_list, render_list_count, &state.memory.transient_arena);
+        u32 render_list_mesh_count = GetMeshCount(render_list, render_list_count);
+        BeginRenderQueue(&queue, 3 * render_list_mesh_count, (SHADOW_CASCADES_COUNT + 1) * render_list_mesh_count,
+                         &state.memory.transient_arena);
+        PushShadowCasterList(&queue, current_shadow_shader->id, &shadow_view, render_list, &render_list_groups,
+                             &render_list_transforms, cascade_frustums, SHADOW_CASCADES_COUNT, use_layered_shadows);
+        PushNodeList(&queue, deferred_shading ? &gbuffer_shaders : &pbr_shaders,
+                     depth_prepass ? &depth_prepass_shaders : NULL, &camera_view, render_list,
+                     &render_list_groups, &render_list_transforms, &camera_frustum);
+        SortRenderQueue(&queue, &state.memory.transient_arena);
+
+        GLEnable(GL_DEPTH_CLAMP);
+        GLBindFramebuffer(GL_FRAMEBUFFER, light_fbo);
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        GLViewport(0, 0, depth_map_resolution, depth_map_resolution);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        GLCullFace(GL_FRONT);
+        if(use_layered_shadows != last_use_layered_shadows)
+        {
+            // NOTE: don't mix the timings of the two paths in the same average
+            ResetGPUPassSamples(&profiler, GPUProfilerPass_Shadow);
+            last_use_layered_shadows = use_layered_shadows;
+        }
+        BeginGPUPass(&profiler, GPUProfilerPass_Shadow);
+        SubmitRenderPass(&queue, RenderPass_Shadow, &shadow_draw_buffer, &state.memory.transient_arena);
+        EndGPUPass(&profiler, GPUProfilerPass_Shadow);
+        GLCullFace(GL_BACK);
 
-        // TODO: add normal matrix to the shaders to fix normals on non-uniform transforms
-        mat4x4 model = Identity();
-        light_shader.use();
-        light_shader.set_mat4("projection_mul_view", projection_mul_view);
-        // TODO: include light emitters in the render list
-        for(u32 i = 0; i < light_count; i++)
+        GLBindFramebuffer(GL_FRAMEBUFFER, scene_fbo);
+        GLViewport(0, 0, state.window_width, state.window_height);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        GLDisable(GL_DEPTH_CLAMP);
+
+        frame_uniforms frame = {};
+        frame.projection_mul_view = projection_mul_view;
+        frame.view = view;
+        frame.viewer_position = Vec4(state.player_camera.position, 1.0f);
+        frame.sun_direction = Vec4(sun_direction, 0.0f);
+        for(u32 i = 0; i < SHADOW_CASCADES_COUNT; i++)
         {
-            model = Translation(light_list[i].position) * Scaling(0.1f);
-            light_shader.set_mat4("model", model);
-            light_shader.set_vec3("light_color", light_list[i].color);
-            RenderMesh(&light_mesh);
+            frame.near_plane_cascades[i].x = near_plane_cascades[i];
+            frame.far_plane_cascades[i].x = far_plane_cascades[i];
+        }
+        frame.sun_position = Vec4(sun_position, 1.0f);
+        frame.sun_color = Vec4(sun_color, 0.0f);
+        frame.cluster_tile_size = Vec4((f32)state.window_width / CLUSTER_GRID_X,
+                                       (f32)state.window_height / CLUSTER_GRID_Y, 0.0f, 0.0f);
+        cluster_depth_slicing slicing = GetClusterDepthSlicing(state.player_camera.settings.near_plane,
+                                                               state.player_camera.settings.far_plane);
+        frame.cluster_depth_slicing = Vec4(slicing.near_plane, slicing.far_plane, slicing.scale, slicing.bias);
+        UploadUniformBuffer(frame_ubo, &frame, sizeof(frame));
+        BuildLightClusters(&clusters, light_list.data(), (u32)light_list.size(), view, projection,
+                           state.player_camera.settings.near_plane, state.player_camera.settings.far_plane,
+                           &state.memory.transient_arena);
+
+        // NOTE: camera, sun and cascades come from the uniform buffers, the point lights
+        //       from the cluster buffers and the samplers have fixed bindings in the shader
+        BindLightClusters(&clusters);
+        GLActiveTexture(GL_TEXTURE5);
+        GLBindTexture(GL_TEXTURE_2D_ARRAY, light_depth_maps);
+        BindMaterials(&global_material_system);
+        if(deferred_shading)
+        {
+            GLBindFramebuffer(GL_FRAMEBUFFER, gbuffer.fbo);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        }
+        if(depth_prepass != last_depth_prepass)
+        {
+            ResetGPUPassSamples(&profiler, GPUProfilerPass_DepthPrepass);
+            ResetGPUPassSamples(&profiler, GPUProfilerPass_Opaque);
+            last_depth_prepass = depth_prepass;
+        }
+        if(depth_prepass)
+        {
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            BeginGPUPass(&profiler, GPUProfilerPass_DepthPrepass);
+            SubmitRenderPass(&queue, RenderPass_Depth, &scene_draw_buffer, &state.memory.transient_arena);
+            EndGPUPass(&profiler, GPUProfilerPass_DepthPrepass);
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+            // NOTE: the depth is final, only the fragments that wrote it pass
+            glDepthMask(GL_FALSE);
+            GLDepthFunc(GL_EQUAL);
+        }
+        BeginGPUPass(&profiler, GPUProfilerPass_Opaque);
+        SubmitRenderPass(&queue, RenderPass_Opaque, &scene_draw_buffer, &state.memory.transient_arena);
+        EndGPUPass(&profiler, GPUProfilerPass_Opaque);
+        glDepthMask(GL_TRUE);
+        GLDepthFunc(GL_LESS);
+        if(deferred_shading)
+        {
+            BeginGPUPass(&profiler, GPUProfilerPass_DeferredLighting);
+            GLBindFramebuffer(GL_FRAMEBUFFER, scene_fbo);
+            GLDisable(GL_DEPTH_TEST);
+            deferred_lighting_shader->use();
+            deferred_lighting_shader->set_mat4("inverse_projection_mul_view", Inverse(projection_mul_view));
+            BindGBufferTextures(&gbuffer);
+            GLBindVertexArray(screen_quad_vao);
+            glDrawArrays(GL_TRIANGLES, 0, 6);
+            EndGPUPass(&profiler, GPUProfilerPass_DeferredLighting);
+            GLEnable(GL_DEPTH_TEST);
+            // NOTE: scene_fbo is the hdr framebuffer, whose renderbuffer has the same depth
+            //       format. Without post processing it's the default framebuffer, which may not,
+            //       in that case the blit fails and the forward passes below draw over the scene
+            CopyGBufferDepth(&gbuffer, scene_fbo);
         }
-        
-        pbr_shader.use();
-        pbr_shader.set_mat4("projection_mul_view", projection_mul_view);
-        pbr_shader.set_mat4("view", view);
-        pbr_shader.set_vec3("viewer_position", state.player_camera.position);
-        pbr_shader.set_int("albedo_map", 0);
-        pbr_shader.set_int("normal_map", 1);
-        pbr_shader.set_int("metallic_map", 2);
-        pbr_shader.set_int("roughness_map", 3);
-        pbr_shader.set_int("ambient_occlusion_map", 4);
-        pbr_shader.set_vec3("sun_direction", sun_direction);
-        pbr_shader.set_int("shadow_map", 5);
-        pbr_shader.set_int("use_metallic_roughness", 0);
-        pbr_shader.set_float("near_plane_cascades[0]", near_plane_cascades[0]);
-        pbr_shader.set_float("near_plane_cascades[1]", near_plane_cascades[1]);
-        pbr_shader.set_float("near_plane_cascades[2]", near_plane_cascades[2]);
-        pbr_shader.set_float("far_plane_cascades[0]", far_plane_cascades[0]);
-        pbr_shader.set_float("far_plane_cascades[1]", far_plane_cascades[1]);
-        pbr_shader.set_float("far_plane_cascades[2]", far_plane_cascades[2]);
-        SetLightInShader(&pbr_shader, light_list, light_count);
-
-        glActiveTexture(GL_TEXTURE5);
-        glBindTexture(GL_TEXTURE_2D_ARRAY, light_depth_maps);
-        RenderNodeList(&pbr_shader, render_list, render_list_count);
 
+        // NOTE: one instance per light, the vertex shader reads the position and color
+        //       from the light buffer bound with the clusters
+        BeginGPUPass(&profiler, GPUProfilerPass_LightCubes);
+        if(light_list.size() > 0)
+        {
+            u32 light_count = (u32)light_list.size();
+            draw_list light_draw_list;
+            BeginDrawList(&light_draw_list, 1, light_count, &state.memory.transient_arena);
+            draw_instance *light_instances = PushArray(&state.memory.transient_arena, light_count, draw_instance);
+            for(u32 i = 0; i < light_count; i++)
+            {
+                light_instances[i] = {i, 0};
+            }
+            BeginDrawRun(&light_draw_list, light_shader.id);
+            PushDraw(&light_draw_list, &light_mesh, light_instances, light_count);
+            SubmitDrawList(&light_draw_list, &light_draw_buffer);
+        }
+        EndGPUPass(&profiler, GPUProfilerPass_LightCubes);
+
+        BeginGPUPass(&profiler, GPUProfilerPass_Skybox);
         skybox_shader.use();
         view = Mat4x4(Mat3x3(CameraViewMatrix(&state.player_camera)));
         projection_mul_view = perspective_projection * view;
         skybox_shader.set_mat4("projection_mul_view", projection_mul_view);
-        glDepthFunc(GL_LEQUAL);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, skybox_cubemap);
+        GLDepthFunc(GL_LEQUAL);
+        GLActiveTexture(GL_TEXTURE0);
+        GLBindTexture(GL_TEXTURE_CUBE_MAP, skybox_cubemap);
         skybox_shader.set_int("skybox_cubemap", 0);
         RenderMesh(&sky_mesh);
-        glDepthFunc(GL_LESS);
-        glBindTexture(GL_TEXTURE_2D, 0);
-
-        glBindFramebuffer(GL_FRAMEBUFFER, bloom_fbo);
-        downsampler_shader.use();
-        downsampler_shader.set_int("source_texture", 0);
-        downsampler_shader.set_vec2("source_resolution", Vec2(state.window_width, state.window_height));
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, render_fbo_texture);
-        glDisable(GL_BLEND);
-        for(i32 i = 0; i < BLOOM_MIP_COUNT; i++)
-        {
-            vec2 dim = bloom_mip_list[i].screen_size;
-            glViewport(0, 0, dim.x, dim.y);
-            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 
-                                   bloom_mip_list[i].texture_id, 0);
-
-            glBindVertexArray(screen_quad_vao);
-            glDrawArrays(GL_TRIANGLES, 0, 6);
+        GLDepthFunc(GL_LESS);
+        EndGPUPass(&profiler, GPUProfilerPass_Skybox);
 
-            downsampler_shader.set_vec2("source_resolution", dim);
-            glBindTexture(GL_TEXTURE_2D, bloom_mip_list[i].texture_id);
-        }
-
-        upsampler_shader.use();
-        upsampler_shader.set_int("source_texture", 0);
-        // NOTE, TODO: the radius should be different for the width and height
-        //             as the blur can become noticeably wrong especially on 21:9 viewports
-        //             the vertical filters_radius in particular should be multiplied by
-        //             the aspect ratio  
-        upsampler_shader.set_float("filter_radius", 0.005f);
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_ONE, GL_ONE);
-        glBlendEquation(GL_FUNC_ADD);
-        for(i32 i = BLOOM_MIP_COUNT - 1; i > 0; i--)
-        {
-            bloom_mip mip = bloom_mip_list[i];
-            bloom_mip next_mip = bloom_mip_list[i - 1];
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, mip.texture_id);
-            glViewport(0, 0, (i32)next_mip.screen_size.x, (i32)next_mip.screen_size.y);
-            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, next_mip.texture_id, 0);
+        // NOTE: without bloom the post processing permutation doesn't sample the mips
+        if(bloom_enabled)
+        {
+            BeginGPUPass(&profiler, GPUProfilerPass_BloomDownsample);
+            GLBindFramebuffer(GL_FRAMEBUFFER, bloom_fbo);
+            downsampler_shader.use();
+            downsampler_shader.set_int("source_texture", 0);
+            downsampler_shader.set_vec2("source_resolution", Vec2(state.window_width, state.window_height));
+            GLActiveTexture(GL_TEXTURE0);
+            GLBindTexture(GL_TEXTURE_2D, render_fbo_texture);
+            GLDisable(GL_BLEND);
+            for(i32 i = 0; i < BLOOM_MIP_COUNT; i++)
+            {
+                vec2 dim = bloom_mip_list[i].screen_size;
+                GLViewport(0, 0, dim.x, dim.y);
+                glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 
+                                       bloom_mip_list[i].texture_id, 0);
+
+                GLBindVertexArray(screen_quad_vao);
+                glDrawArrays(GL_TRIANGLES, 0, 6);
+
+                downsampler_shader.set_vec2("source_resolution", dim);
+                GLBindTexture(GL_TEXTURE_2D, bloom_mip_list[i].texture_id);
+            }
+            EndGPUPass(&profiler, GPUProfilerPass_BloomDownsample);
+
+            BeginGPUPass(&profiler, GPUProfilerPass_BloomUpsample);
+            upsampler_shader.use();
+            upsampler_shader.set_int("source_texture", 0);
+            // NOTE, TODO: the radius should be different for the width and height
+            //             as the blur can become noticeably wrong especially on 21:9 viewports
+            //             the vertical filters_radius in particular should be multiplied by
+            //             the aspect ratio  
+            upsampler_shader.set_float("filter_radius", 0.005f);
+            GLEnable(GL_BLEND);
+            GLBlendFunc(GL_ONE, GL_ONE);
+            GLBlendEquation(GL_FUNC_ADD);
+            for(i32 i = BLOOM_MIP_COUNT - 1; i > 0; i--)
+            {
+                bloom_mip mip = bloom_mip_list[i];
+                bloom_mip next_mip = bloom_mip_list[i - 1];
+                GLActiveTexture(GL_TEXTURE0);
+                GLBindTexture(GL_TEXTURE_2D, mip.texture_id);
+                GLViewport(0, 0, (i32)next_mip.screen_size.x, (i32)next_mip.screen_size.y);
+                glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, next_mip.texture_id, 0);
         
-            glBindVertexArray(screen_quad_vao);
-            glDrawArrays(GL_TRIANGLES, 0, 6);
+                GLBindVertexArray(screen_quad_vao);
+                glDrawArrays(GL_TRIANGLES, 0, 6);
+            }
+            EndGPUPass(&profiler, GPUProfilerPass_BloomUpsample);
         }
-        glBindVertexArray(0);
 
 #if POST_PROCESSING_ENABLED
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        glViewport(0, 0, state.window_width, state.window_height);
+        BeginGPUPass(&profiler, GPUProfilerPass_PostProcessing);
+        GLBindFramebuffer(GL_FRAMEBUFFER, 0);
+        GLViewport(0, 0, state.window_width, state.window_height);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glDisable(GL_DEPTH_TEST);
-        glDisable(GL_BLEND);
-        postprocessing_shader.use();
-        postprocessing_shader.set_int("screen_texture", 0);
-        postprocessing_shader.set_int("bloom_texture", 1);
-        postprocessing_shader.set_float("exposure", tonemapping_exposure);
-        postprocessing_shader.set_int("tonemapper_choice", tonemapper_choice);
-
-        // NOTE: post processing options at the moment don't actually save
-        //       any computational time, this flag just helps
-        //       seeing the visual differences
-        // TODO: graphics settings, different compiled shaders
-        //       for different settings
-        postprocessing_shader.set_int("bloom_enabled", bloom_enabled);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, render_fbo_texture);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, bloom_mip_list[0].texture_id);
-        glBindVertexArray(screen_quad_vao);
+        GLDisable(GL_DEPTH_TEST);
+        GLDisable(GL_BLEND);
+        u32 postprocessing_values[] = {bloom_enabled ? 1u : 0u, (u32)tonemapper_choice};
+        ShaderProgram *postprocessing_shader = GetShaderPermutation(&postprocessing_shaders, postprocessing_values);
+        postprocessing_shader->use();
+        postprocessing_shader->set_int("screen_texture", 0);
+        postprocessing_shader->set_int("bloom_texture", 1);
+        postprocessing_shader->set_float("exposure", tonemapping_exposure);
+        GLActiveTexture(GL_TEXTURE0);
+        GLBindTexture(GL_TEXTURE_2D, render_fbo_texture);
+        GLActiveTexture(GL_TEXTURE1);
+        GLBindTexture(GL_TEXTURE_2D, bloom_mip_list[0].texture_id);
+        GLBindVertexArray(screen_quad_vao);
         glDrawArrays(GL_TRIANGLES, 0, 6);
-        glEnable(GL_DEPTH_TEST);
+        GLEnable(GL_DEPTH_TEST);
+        EndGPUPass(&profiler, GPUProfilerPass_PostProcessing);
 #endif
 
         if(render_debug_quad_layer < SHADOW_CASCADES_COUNT)
         {
+            BeginGPUPass(&profiler, GPUProfilerPass_DebugQuad);
             debug_quad_shader.use();
             debug_quad_shader.set_int("layer", render_debug_quad_layer);
             debug_quad_shader.set_float("near_plane", near_plane_cascades[render_debug_quad_layer]);
             debug_quad_shader.set_float("far_plane", far_plane_cascades[render_debug_quad_layer]);
             debug_quad_shader.set_int("shadow_map", 0);
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D_ARRAY, light_depth_maps);
-            glBindVertexArray(quad_vao);
+            GLActiveTexture(GL_TEXTURE0);
+            GLBindTexture(GL_TEXTURE_2D_ARRAY, light_depth_maps);
+            GLBindVertexArray(quad_vao);
             glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-            glBindVertexArray(0);
+            EndGPUPass(&profiler, GPUProfilerPass_DebugQuad);
         }
 
+        EndGPUProfilerFrame(&profiler);
         glfwSwapBuffers(state.window);
         glfwPollEvents();
 
         current_time = glfwGetTime();
         state.delta_time = current_time - state.last_time;
+        report_frame_time += state.delta_time;
+        if((profiler.frame_index % GPU_PROFILER_REPORT_FRAMES) == 0)
+        {
+            f64 average_frame_time = report_frame_time / GPU_PROFILER_REPORT_FRAMES;
+            std::cout << "frame delta: " << (average_frame_time * 1000.0) << "ms, " << (1.0 / average_frame_time)
+                      << "fps, average of the last " << GPU_PROFILER_REPORT_FRAMES << " frames" << std::endl;
+            report_frame_time = 0.0;
+            std::cout << "shadow pass: " << (use_layered_shadows ? "instanced layers" : "geometry shader")
+                      << ", depth pre-pass: " << (depth_prepass ? "on" : "off")
+                      << ", shading: " << (deferred_shading ? "deferred" : "forward") << std::endl;
+            PrintGPUProfilerReport(&profiler);
+            std::cout << "render queue: " << queue.sorted_stats.command_count << " commands, state changes "
+                      << "(shader/vao/material) unsorted " << queue.unsorted_stats.shader_changes << "/"
+                      << queue.unsorted_stats.vao_changes << "/" << queue.unsorted_stats.material_changes
+                      << ", sorted " << queue.sorted_stats.shader_changes << "/"
+                      << queue.sorted_stats.vao_changes << "/" << queue.sorted_stats.material_changes << std::endl;
+            std::cout << "light clusters: " << light_list.size() << " lights, " << clusters.index_count
+                      << " light indices, at most " << clusters.max_cluster_light_count << " per cluster" << std::endl;
+            std::cout << "gl state calls: " << global_gl_state.issued_count << " issued, "
+                      << global_gl_state.skipped_count << " skipped" << std::endl;
+            ResetGLStateCounters();
+        }
 #if 0
         std::cout << "sine: " << day_time_sine << ", day_time: " << day_time << std::endl;
-#else
-        std::cout << "frame delta: " << (state.delta_time * 1000.0f) << "ms, " << (1.0f / state.delta_time) << "fps" << std::endl;
 #endif
     }
+    // NOTE: only created when the mode is supported or picked, delete handles NULL
+    delete deferred_lighting_shader;
+    delete shadow_layered_shader;
+    StopTextureLoader();
     glfwTerminate();
     return(0);
 }
\ No newline at end of file
@@ -7,11 +7,41 @@
 #include "iostream"
 #include "sstream"
 #include "string"
+#include "string.h"
+#include "vector"
+#include "unordered_map"
+#include "stdio.h"
+#include "sys/stat.h"
+
+#include "rd_gl_state.h"
+
+#define UNIFORM_NAME_LENGTH 64
+
+// NOTE: open addressing table entry, an empty name marks a free slot
+struct uniform_entry
+{
+    u32 hash;
+    GLint location;
+    char name[UNIFORM_NAME_LENGTH];
+};
+
+// NOTE: resolved once with get_uniform and then reused in hot loops,
+//       -1 is a valid handle for uniforms that were optimized out
+struct uniform_handle
+{
+    GLint location;
+};
 
 struct ShaderProgram {
     GLuint id;
-    ShaderProgram(const char *vertex_shader_path, const char *fragment_shader_path, const char *geometry_shader_path);
+    std::vector<uniform_entry> uniform_table;
+    u32 uniform_count;
+    ShaderProgram(const char *vertex_shader_path, const char *fragment_shader_path, const char *geometry_shader_path,
+                  const char *defines);
     void use();
+    void cache_uniforms();
+    void insert_uniform(const char *name, GLint location);
+    uniform_handle get_uniform(const char *name);
     void set_int(const char *name, i32 value);
     void set_float(const char *name, f32 value);
     void set_bool(const char *name, b32 value);
@@ -19,21 +49,212 @@ struct ShaderProgram {
     void set_vec3(const char *name, vec3 vec);
     void set_mat4(const char *name, mat4x4 mat);
     void set_mat3(const char *name, mat3x3 mat);
+    void set_int(uniform_handle uniform, i32 value);
+    void set_float(uniform_handle uniform, f32 value);
+    void set_bool(uniform_handle uniform, b32 value);
+    void set_vec2(uniform_handle uniform, vec2 vec);
+    void set_vec3(uniform_handle uniform, vec3 vec);
+    void set_mat4(uniform_handle uniform, mat4x4 mat);
+    void set_mat3(uniform_handle uniform, mat3x3 mat);
 };
 
+// NOTE: defines are inserted right after the #version line, so they can
+//       be used anywhere in the shader (e.g. in layout qualifiers)
+void InjectDefines(std::string &source, const char *defines)
+{
+    if(!defines)
+    {
+        return;
+    }
+    size_t position = 0;
+    if(source.compare(0, 8, "#version") == 0)
+    {
+        position = source.find('\n');
+        position = (position == std::string::npos) ? source.size() : position + 1;
+    }
+    source.insert(position, defines);
+}
+
+std::string ReadShaderFile(const char *path)
+{
+    std::ifstream file{path};
+    if(!file)
+    {
+        std::cout << "can't open shader file: " << path << std::endl;
+    }
+    std::stringstream stream;
+    stream << file.rdbuf();
+    std::string result = stream.str();
+
+    return(result);
+}
+
+// NOTE: every #include "file" line is replaced by the file, relative to the directory of
+//       the shader. The included file can include others, there are no include guards
+void ExpandIncludes(std::string &source, const char *path)
+{
+    std::string directory = path;
+    directory = directory.substr(0, directory.find_last_of('/') + 1);
+    const char *directive = "#include \"";
+    size_t position = 0;
+    while((position = source.find(directive, position)) != std::string::npos)
+    {
+        size_t name_begin = position + strlen(directive);
+        size_t name_end = source.find('"', name_begin);
+        size_t line_end = source.find('\n', position);
+        if(((position > 0) && (source[position - 1] != '\n')) || (name_end == std::string::npos) ||
+           (name_end > line_end))
+        {
+            position = name_begin;
+            continue;
+        }
+        line_end = (line_end == std::string::npos) ? source.size() : line_end + 1;
+        std::string include_path = directory + source.substr(name_begin, name_end - name_begin);
+        source.replace(position, line_end - position, ReadShaderFile(include_path.c_str()));
+    }
+}
+
+// NOTE: the shader cache hashes what this returns, so a change to an included file misses it too
+std::string ReadShaderSource(const char *path, const char *defines)
+{
+    std::string result = ReadShaderFile(path);
+    ExpandIncludes(result, path);
+    InjectDefines(result, defines);
+
+    return(result);
+}
+
+// NOTE: linked programs are saved with glGetProgramBinary and loaded back with glProgramBinary
+//       on the next runs. The file name is a hash of the sources after the defines are
+//       injected and of the driver strings, so any change to either just misses the cache.
+//       A binary the driver rejects anyway falls back to compiling and is overwritten
+#define SHADER_CACHE_FOLDER "bin/shader_cache/"
+#define SHADER_CACHE_EXTENSION ".rdprog"
+#define SHADER_CACHE_MAGIC 0x50534452 // "RDSP"
+#define SHADER_CACHE_VERSION 1
+
+struct shader_cache_header
+{
+    u32 magic;
+    u32 version;
+    u32 binary_format;
+    u32 binary_size;
+};
+
+std::string GetShaderCachePath(std::string *source_list, u32 source_count)
+{
+    // NOTE: the terminators keep the boundaries between the strings in the key
+    std::string key;
+    GLenum string_names[] = {GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION};
+    for(u32 i = 0; i < ArrayCount(string_names); i++)
+    {
+        const char *driver_string = (const char *)glGetString(string_names[i]);
+        key.append(driver_string ? driver_string : "");
+        key.push_back(0);
+    }
+    for(u32 i = 0; i < source_count; i++)
+    {
+        key.append(source_list[i]);
+        key.push_back(0);
+    }
+    u64 hash = HashBytes64((void *)key.data(), key.size());
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx", (unsigned long long)hash);
+    std::string result = std::string(SHADER_CACHE_FOLDER) + name + SHADER_CACHE_EXTENSION;
+
+    return(result);
+}
+
+b32 LoadProgramBinary(GLuint program, std::string &cache_path)
+{
+    FILE *file = fopen(cache_path.c_str(), "rb");
+    if(!file)
+    {
+        return(false);
+    }
+    shader_cache_header header;
+    b32 result = ((fread(&header, sizeof(header), 1, file) == 1) &&
+                  (header.magic == SHADER_CACHE_MAGIC) &&
+                  (header.version == SHADER_CACHE_VERSION));
+    std::vector<u8> binary;
+    if(result)
+    {
+        binary.resize(header.binary_size);
+        result = (header.binary_size > 0) && (fread(&binary[0], 1, header.binary_size, file) == header.binary_size);
+    }
+    fclose(file);
+
+    if(result)
+    {
+        glProgramBinary(program, header.binary_format, &binary[0], header.binary_size);
+        GLint ok;
+        glGetProgramiv(program, GL_LINK_STATUS, &ok);
+        result = ok;
+    }
+
+    return(result);
+}
+
+// NOTE: same temp file + rename as the mesh cache so a crash never leaves a broken binary
+void SaveProgramBinary(GLuint program, std::string &cache_path)
+{
+    GLint binary_size = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &binary_size);
+    if(binary_size <= 0)
+    {
+        return;
+    }
+    std::vector<u8> binary(binary_size);
+    GLenum binary_format;
+    glGetProgramBinary(program, binary_size, NULL, &binary_format, &binary[0]);
+
+    mkdir(SHADER_CACHE_FOLDER, 0755);
+    std::string temp_path = cache_path + ".tmp";
+    FILE *file = fopen(temp_path.c_str(), "wb");
+    if(!file)
+    {
+        return;
+    }
+    shader_cache_header header = {SHADER_CACHE_MAGIC, SHADER_CACHE_VERSION, binary_format, (u32)binary_size};
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(&binary[0], 1, binary_size, file);
+    b32 written = (ferror(file) == 0);
+    fclose(file);
+    if(written)
+    {
+        rename(temp_path.c_str(), cache_path.c_str());
+    }
+    else
+    {
+        remove(temp_path.c_str());
+    }
+}
+
 ShaderProgram::ShaderProgram(const char *vertex_shader_path, const char *fragment_shader_path, 
-                             const char *geometry_shader_path = NULL) {
-    std::ifstream vertex_file{vertex_shader_path};
-    std::stringstream vertex_stream;
-    vertex_stream << vertex_file.rdbuf();
-    std::string vertex_string = vertex_stream.str();
-    const char *vertex_src = vertex_string.c_str();
-
-    std::ifstream fragment_file{fragment_shader_path};
-    std::stringstream fragment_stream;
-    fragment_stream << fragment_file.rdbuf();
-    std::string fragment_string = fragment_stream.str();
-    const char *fragment_src = fragment_string.c_str();
+                             const char *geometry_shader_path = NULL, const char *defines = NULL) {
+    // NOTE: vertex, fragment and the optional geometry shader
+    std::string source_list[3];
+    source_list[0] = ReadShaderSource(vertex_shader_path, defines);
+    source_list[1] = ReadShaderSource(fragment_shader_path, defines);
+    u32 source_count = 2;
+    if(geometry_shader_path)
+    {
+        source_list[source_count++] = ReadShaderSource(geometry_shader_path, defines);
+    }
+
+    std::string cache_path = GetShaderCachePath(source_list, source_count);
+    this->id = glCreateProgram();
+    if(LoadProgramBinary(this->id, cache_path))
+    {
+        cache_uniforms();
+        return;
+    }
+    // NOTE: a failed glProgramBinary leaves the program unusable, start from a new one
+    glDeleteProgram(this->id);
+    this->id = glCreateProgram();
+
+    const char *vertex_src = source_list[0].c_str();
+    const char *fragment_src = source_list[1].c_str();
 
     GLint ok;
     const uint16_t LOG_LENGTH = 1024;
@@ -58,14 +279,10 @@ ShaderProgram::ShaderProgram(const char *vertex_shader_path, const char *fragmen
                   << info_log << std::endl;
     }
 
-    GLuint geometry_shader;
+    GLuint geometry_shader = 0;
     if(geometry_shader_path)
     {
-        std::ifstream geometry_file{geometry_shader_path};
-        std::stringstream geometry_stream;
-        geometry_stream << geometry_file.rdbuf();
-        std::string geometry_string = geometry_stream.str();
-        const char *geometry_src = geometry_string.c_str();
+        const char *geometry_src = source_list[2].c_str();
         geometry_shader = glCreateShader(GL_GEOMETRY_SHADER);
         glShaderSource(geometry_shader, 1, &geometry_src, NULL);
         glCompileShader(geometry_shader);
@@ -77,13 +294,13 @@ ShaderProgram::ShaderProgram(const char *vertex_shader_path, const char *fragmen
         } 
     }
 
-    this->id = glCreateProgram();
     glAttachShader(this->id, vertex_shader);
     glAttachShader(this->id, fragment_shader);
     if(geometry_shader_path)
     {
         glAttachShader(this->id, geometry_shader);
     }
+    glProgramParameteri(this->id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glLinkProgram(this->id);
     glGetProgramiv(this->id, GL_LINK_STATUS, &ok);
     if (!ok) {
@@ -91,50 +308,273 @@ ShaderProgram::ShaderProgram(const char *vertex_shader_path, const char *fragmen
         std::cout << "PROGRAM LINKING ERROR:\n"
                   << info_log << std::endl;
     }
+    else
+    {
+        SaveProgramBinary(this->id, cache_path);
+    }
     glDeleteShader(vertex_shader);
     glDeleteShader(fragment_shader);
     glDeleteShader(geometry_shader);
+
+    cache_uniforms();
+}
+
+// NOTE: fills the location table with every active uniform after linking,
+//       arrays are reported once as "name[0]" so every element is added explicitly
+void ShaderProgram::cache_uniforms()
+{
+    GLint active_count = 0;
+    glGetProgramiv(this->id, GL_ACTIVE_UNIFORMS, &active_count);
+
+    u32 capacity = 64;
+    while(capacity < (u32)active_count * 4)
+    {
+        capacity *= 2;
+    }
+    this->uniform_table.assign(capacity, uniform_entry{});
+    this->uniform_count = 0;
+
+    char name[UNIFORM_NAME_LENGTH];
+    char element_name[UNIFORM_NAME_LENGTH];
+    for(GLint uniform_index = 0; uniform_index < active_count; uniform_index++)
+    {
+        GLsizei length = 0;
+        GLint size = 0;
+        GLenum type;
+        glGetActiveUniform(this->id, uniform_index, UNIFORM_NAME_LENGTH, &length, &size, &type, name);
+        GLint location = glGetUniformLocation(this->id, name);
+        if(location < 0)
+        {
+            // NOTE: uniforms inside blocks don't have a location
+            continue;
+        }
+        insert_uniform(name, location);
+
+        if((length > 3) && (strcmp(name + length - 3, "[0]") == 0))
+        {
+            name[length - 3] = 0;
+            insert_uniform(name, location);
+            for(GLint element = 1; element < size; element++)
+            {
+                snprintf(element_name, UNIFORM_NAME_LENGTH, "%s[%d]", name, element);
+                insert_uniform(element_name, glGetUniformLocation(this->id, element_name));
+            }
+        }
+    }
+}
+
+void ShaderProgram::insert_uniform(const char *name, GLint location)
+{
+    Assert(strlen(name) < UNIFORM_NAME_LENGTH);
+    if((this->uniform_count + 1) * 2 > this->uniform_table.size())
+    {
+        std::vector<uniform_entry> old_table = this->uniform_table;
+        this->uniform_table.assign(old_table.size() * 2, uniform_entry{});
+        this->uniform_count = 0;
+        for(uniform_entry &entry : old_table)
+        {
+            if(entry.name[0])
+            {
+                insert_uniform(entry.name, entry.location);
+            }
+        }
+    }
+
+    u32 hash = HashString(name);
+    u32 mask = (u32)this->uniform_table.size() - 1;
+    for(u32 slot = hash & mask;; slot = (slot + 1) & mask)
+    {
+        uniform_entry *entry = &this->uniform_table[slot];
+        if(!entry->name[0])
+        {
+            entry->hash = hash;
+            entry->location = location;
+            strncpy(entry->name, name, UNIFORM_NAME_LENGTH - 1);
+            this->uniform_count++;
+            break;
+        }
+        if((entry->hash == hash) && (strcmp(entry->name, name) == 0))
+        {
+            entry->location = location;
+            break;
+        }
+    }
+}
+
+// NOTE: names that aren't in the table (e.g. misspelled or inactive uniforms)
+//       are asked to the driver once and then cached as well
+uniform_handle ShaderProgram::get_uniform(const char *name)
+{
+    // NOTE: entries keep at most UNIFORM_NAME_LENGTH - 1 characters, a longer name would never match
+    Assert(strlen(name) < UNIFORM_NAME_LENGTH);
+    uniform_handle result;
+    u32 hash = HashString(name);
+    u32 mask = (u32)this->uniform_table.size() - 1;
+    for(u32 slot = hash & mask;; slot = (slot + 1) & mask)
+    {
+        uniform_entry *entry = &this->uniform_table[slot];
+        if(!entry->name[0])
+        {
+            break;
+        }
+        if((entry->hash == hash) && (strcmp(entry->name, name) == 0))
+        {
+            result.location = entry->location;
+            return(result);
+        }
+    }
+
+    result.location = glGetUniformLocation(this->id, name);
+    insert_uniform(name, result.location);
+
+    return(result);
 }
 
 void ShaderProgram::use()
 {
-    glUseProgram(id);
+    GLUseProgram(id);
 }
 
 void ShaderProgram::set_int(const char *name, i32 value)
 {
-    glUniform1i(glGetUniformLocation(id, name), value);
+    set_int(get_uniform(name), value);
 }
 
 void ShaderProgram::set_float(const char *name, f32 value) 
 {
-    glUniform1f(glGetUniformLocation(id, name), value);
+    set_float(get_uniform(name), value);
 }
 
 void ShaderProgram::set_bool(const char* name, b32 value)
 {
-    glUniform1i(glGetUniformLocation(id, name), value);
+    set_bool(get_uniform(name), value);
 }
 
 void ShaderProgram::set_vec2(const char *name, vec2 vec)
 {
-   glUniform2fv(glGetUniformLocation(id, name), 1, &vec.e[0]); 
+    set_vec2(get_uniform(name), vec);
 }
 
 void ShaderProgram::set_vec3(const char *name, vec3 vec)
 {
-   glUniform3fv(glGetUniformLocation(id, name), 1, &vec.e[0]); 
+    set_vec3(get_uniform(name), vec);
 }
 
 void ShaderProgram::set_mat4(const char *name, mat4x4 mat)
 {
-    glUniformMatrix4fv(glGetUniformLocation(id, name), 1, GL_TRUE, &mat.e[0][0]);
+    set_mat4(get_uniform(name), mat);
 }
 
 void ShaderProgram::set_mat3(const char *name, mat3x3 mat)
 {
-    glUniformMatrix3fv(glGetUniformLocation(id, name), 1, GL_TRUE, &mat.e[0][0]);
+    set_mat3(get_uniform(name), mat);
 }
 
+void ShaderProgram::set_int(uniform_handle uniform, i32 value)
+{
+    glUniform1i(uniform.location, value);
+}
+
+void ShaderProgram::set_float(uniform_handle uniform, f32 value) 
+{
+    glUniform1f(uniform.location, value);
+}
+
+void ShaderProgram::set_bool(uniform_handle uniform, b32 value)
+{
+    glUniform1i(uniform.location, value);
+}
+
+void ShaderProgram::set_vec2(uniform_handle uniform, vec2 vec)
+{
+   glUniform2fv(uniform.location, 1, &vec.e[0]); 
+}
+
+void ShaderProgram::set_vec3(uniform_handle uniform, vec3 vec)
+{
+   glUniform3fv(uniform.location, 1, &vec.e[0]); 
+}
+
+void ShaderProgram::set_mat4(uniform_handle uniform, mat4x4 mat)
+{
+    glUniformMatrix4fv(uniform.location, 1, GL_TRUE, &mat.e[0][0]);
+}
+
+void ShaderProgram::set_mat3(uniform_handle uniform, mat3x3 mat)
+{
+    glUniformMatrix3fv(uniform.location, 1, GL_TRUE, &mat.e[0][0]);
+}
+
+// NOTE: compile time options of a shader, value v of an option is injected
+//       as "#define NAME v" so the shader branches with #if instead of uniforms.
+//       Every combination is its own program, compiled the first time it's asked for
+#define MAX_SHADER_OPTIONS 8
+
+struct shader_option
+{
+    const char *name;
+    u32 value_count;
+};
+
+struct shader_permutations
+{
+    const char *vertex_shader_path;
+    const char *fragment_shader_path;
+    const char *geometry_shader_path;
+    // NOTE: common to every permutation, injected before the options
+    std::string defines;
+    u32 option_count;
+    shader_option option_list[MAX_SHADER_OPTIONS];
+    std::unordered_map<u32, ShaderProgram> program_table;
+};
+
+void InitializeShaderPermutations(shader_permutations *permutations, const char *vertex_shader_path,
+                                  const char *fragment_shader_path, const char *geometry_shader_path,
+                                  const char *defines, shader_option *option_list, u32 option_count)
+{
+    Assert(option_count <= MAX_SHADER_OPTIONS);
+    permutations->vertex_shader_path = vertex_shader_path;
+    permutations->fragment_shader_path = fragment_shader_path;
+    permutations->geometry_shader_path = geometry_shader_path;
+    permutations->defines = defines ? defines : "";
+    permutations->option_count = option_count;
+    for(u32 option_index = 0; option_index < option_count; option_index++)
+    {
+        permutations->option_list[option_index] = option_list[option_index];
+    }
+}
+
+// NOTE: value_list has one value per option in the order they were given
+ShaderProgram *GetShaderPermutation(shader_permutations *permutations, u32 *value_list)
+{
+    u32 key = 0;
+    for(u32 option_index = permutations->option_count; option_index-- > 0;)
+    {
+        shader_option *option = &permutations->option_list[option_index];
+        Assert(value_list[option_index] < option->value_count);
+        key = key * option->value_count + value_list[option_index];
+    }
+
+    auto found = permutations->program_table.find(key);
+    if(found != permutations->program_table.end())
+    {
+        return(&found->second);
+    }
+
+    std::string defines = permutations->defines;
+    char define[128];
+    for(u32 option_index = 0; option_index < permutations->option_count; option_index++)
+    {
+        snprintf(define, sizeof(define), "#define %s %u\n", permutations->option_list[option_index].name,
+                 value_list[option_index]);
+        defines += define;
+    }
+    // NOTE: elements of an unordered_map don't move, the pointer stays valid
+    ShaderProgram *result = &permutations->program_table.insert(
+        {key, ShaderProgram(permutations->vertex_shader_path, permutations->fragment_shader_path,
+                            permutations->geometry_shader_path, defines.c_str())}).first->second;
+
+    return(result);
+}
 
 #endif
\ No newline at end of file
@@ -0,0 +1,285 @@
+// NOTE: code shared by the shaders, ReadShaderSource replaces #include "common.glsl"
+//       with this file. A shader picks the parts it needs by defining them before the include:
+//       COMMON_FRAME: frame_ubo, CASCADE_COUNT is injected when compiling
+//       COMMON_MATERIALS: material buffer and maps of the mesh fragment shaders. MATERIAL_BINDLESS,
+//                         MAX_MATERIAL_ARRAYS and MATERIAL_ARRAY_FIRST_UNIT are injected when compiling
+//       COMMON_LIGHTS: the point light buffer
+//       COMMON_LIGHTING: lights, clusters, shadows and brdf, needs COMMON_FRAME.
+//                        CLUSTER_GRID_X/Y/Z are injected when compiling
+
+#ifdef COMMON_LIGHTING
+#define COMMON_LIGHTS
+#endif
+
+#ifdef COMMON_FRAME
+layout (std140, row_major, binding = 1) uniform frame_ubo
+{
+    mat4 projection_mul_view;
+    mat4 view;
+    vec3 viewer_position;
+    vec3 sun_direction;
+    float near_plane_cascades[CASCADE_COUNT];
+    float far_plane_cascades[CASCADE_COUNT];
+    vec3 sun_position;
+    vec3 sun_color;
+    // NOTE: xy = size of a cluster tile in pixels
+    vec2 cluster_tile_size;
+    // NOTE: near, far, scale, bias, slice = log(depth) * scale - bias
+    vec4 cluster_depth_slicing;
+};
+#endif
+
+#ifdef COMMON_MATERIALS
+in vs_out
+{
+    vec3 fragment_position;
+    vec3 normal;
+    vec2 tex_coords;
+} vertex_output;
+
+// NOTE, TODO: temporary for gltf format, USE_METALLIC_ROUGHNESS is injected when compiling
+// r=occlusion, g=roughness, b=metalness
+
+// NOTE: index in the material buffer, from the draw list
+flat in uint material_index;
+
+#define ALBEDO_MAP 0
+#define NORMAL_MAP 1
+#define METALLIC_MAP 2
+#define ROUGHNESS_MAP 3
+#define AMBIENT_OCCLUSION_MAP 4
+
+#if MATERIAL_BINDLESS
+struct material_data
+{
+    uvec2 maps[5];
+};
+#else
+// NOTE: (array index << 16) | layer
+struct material_data
+{
+    uint maps[5];
+    uint pad[3];
+};
+
+layout (binding = MATERIAL_ARRAY_FIRST_UNIT) uniform sampler2DArray material_arrays[MAX_MATERIAL_ARRAYS];
+#endif
+
+layout (std430, binding = 1) readonly buffer material_buffer
+{
+    material_data materials[];
+};
+
+// NOTE: material_index comes from a per instance attribute, it's only dynamically uniform
+//       because SubmitRenderPass never puts two materials in the same multi draw
+vec4 SampleMaterialMap(int map, vec2 tex_coords)
+{
+#if MATERIAL_BINDLESS
+    return texture(sampler2D(materials[material_index].maps[map]), tex_coords);
+#else
+    uint location = materials[material_index].maps[map];
+    return texture(material_arrays[location >> 16], vec3(tex_coords, float(location & 0xFFFFu)));
+#endif
+}
+
+// NOTE: copy pasted from LearnOGL site
+// TODO: re-read how the TBN matrix works
+vec3 GetNormalFromMap()
+{
+    // NOTE: z is rebuilt from xy so two channel (BC5) normal maps work too
+    vec3 tangent_normal;
+    tangent_normal.xy = SampleMaterialMap(NORMAL_MAP, vertex_output.tex_coords).xy * 2.0f - 1.0f;
+    tangent_normal.z = sqrt(max(1.0f - dot(tangent_normal.xy, tangent_normal.xy), 0.0f));
+    vec3 Q1 = dFdx(vertex_output.fragment_position);
+    vec3 Q2 = dFdy(vertex_output.fragment_position);
+    vec2 st1 = dFdx(vertex_output.tex_coords);
+    vec2 st2 = dFdy(vertex_output.tex_coords);
+
+    vec3 N = normalize(vertex_output.normal);
+    vec3 T = normalize(Q1*st2.t - Q2*st1.t);
+    vec3 B = -normalize(cross(N, T));
+    mat3 TBN = mat3(T, B, N);
+
+    vec3 result = normalize(TBN * tangent_normal);
+    return(result);
+}
+#endif
+
+#ifdef COMMON_LIGHTS
+// NOTE: xyz = position, w = radius
+struct point_light
+{
+    vec4 position_radius;
+    vec4 color;
+};
+
+layout (std430, binding = 2) readonly buffer light_buffer
+{
+    point_light lights[];
+};
+#endif
+
+#ifdef COMMON_LIGHTING
+#define PI32 3.14159265359f
+
+// NOTE: every cluster is an (offset, count) range of light_indices
+layout (std430, binding = 3) readonly buffer cluster_buffer
+{
+    uvec2 clusters[];
+};
+
+layout (std430, binding = 4) readonly buffer light_index_buffer
+{
+    uint light_indices[];
+};
+
+// SHADOW VARIABLES
+layout (binding = 5) uniform sampler2DArray shadow_map;
+
+layout (std140, binding = 0) uniform light_space_matrices_ubo
+{
+    mat4 light_space_matrices[CASCADE_COUNT];
+};
+
+float CalculateShadow(vec3 world_position, vec3 normal)
+{
+    vec4 view_position = view * vec4(world_position, 1.0f);
+    float depth_value = abs(view_position.z);
+
+    int layer = CASCADE_COUNT;
+    for(int i = 0; i < CASCADE_COUNT; i++)
+    {
+        if(depth_value < far_plane_cascades[i])
+        {
+            layer = i;
+            break;
+        }
+    }
+    if(layer == CASCADE_COUNT)
+    {
+        layer = CASCADE_COUNT - 1;
+    }
+    vec4 light_space_pos = light_space_matrices[layer] * vec4(world_position, 1.0f);
+    vec3 projected_coords = light_space_pos.xyz / light_space_pos.w;
+    projected_coords = projected_coords * 0.5f + 0.5f;
+    float current_depth = projected_coords.z;
+    if(current_depth > 1.0f)
+    {
+        return 0.0f;
+    }
+
+    float bias = max(0.05f * (1.0f - dot(normal, sun_direction)), 0.005f);
+    if(layer == CASCADE_COUNT - 1)
+    {
+        bias *= 1.0f / (far_plane_cascades[layer] * 0.5f);
+    }
+    else
+    {
+        bias *= 1.0f / ((far_plane_cascades[layer] - near_plane_cascades[layer]) * 0.5f);
+    }
+
+    float shadow = 0.0f;
+    vec2 texel_size = 1.0f / vec2(textureSize(shadow_map, 0));
+    for(int x = -1; x <= 1; x++)
+    {
+        for(int y = -1; y <= 1; y++)
+        {
+            float pcf_depth = texture(shadow_map, vec3(projected_coords.xy + vec2(x, y) * texel_size, layer)).r;
+            shadow += (current_depth - bias) > pcf_depth ? 1.0f : 0.0f;
+        }
+    }
+    shadow /= 9.0f;
+
+    return(shadow);
+}
+
+float NormalDistributionGGX(vec3 normal, vec3 halfway, float roughness)
+{
+    // NOTE: based on observations by epic games the lighting seems more correct
+    //       if we square the roughness first
+    float a = roughness * roughness;
+    float a2 = a * a;
+    float n_dot_h = clamp(dot(normal, halfway), 0.0f, 1.0f);
+    float n_dot_h2 = n_dot_h * n_dot_h;
+
+    float denominator = (n_dot_h2 * (a2 - 1.0f) + 1.0f);
+    denominator = PI32 * denominator * denominator;
+
+    float result = a2 / denominator;
+    return(result);
+}
+
+float GeometryShlickGGX(vec3 normal, vec3 view_direction, float roughness)
+{
+    float n_dot_v = clamp(dot(normal, view_direction), 0.0f, 1.0f);
+
+    float r = (roughness + 1.0f);
+    float k = (r * r) / 8.0f;
+    float denominator = n_dot_v * (1.0f - k) + k;
+    float result = (n_dot_v / denominator);
+
+    return(result);
+}
+
+float GeometrySmithShlick(vec3 normal, vec3 view, vec3 light, float roughness)
+{
+    float ggx1 = GeometryShlickGGX(normal, view, roughness);
+    float ggx2 = GeometryShlickGGX(normal, light, roughness);
+    float result = ggx1 * ggx2;
+
+    return(result);
+}
+
+vec3 FresnelSchlick(float cos_theta, vec3 F0)
+{
+    vec3 result = F0 + (1.0f - F0) * pow(clamp(1.0f - cos_theta, 0.0f, 1.0f), 5.0f);
+    return(result);
+}
+
+uint GetClusterIndex(vec3 world_position)
+{
+    float depth = -(view * vec4(world_position, 1.0f)).z;
+    depth = clamp(depth, cluster_depth_slicing.x, cluster_depth_slicing.y);
+    int slice = int(log(depth) * cluster_depth_slicing.z - cluster_depth_slicing.w);
+    uvec3 cluster = uvec3(clamp(ivec2(gl_FragCoord.xy / cluster_tile_size), ivec2(0),
+                                ivec2(CLUSTER_GRID_X - 1, CLUSTER_GRID_Y - 1)),
+                          clamp(slice, 0, CLUSTER_GRID_Z - 1));
+    uint result = (cluster.z * CLUSTER_GRID_Y + cluster.y) * CLUSTER_GRID_X + cluster.x;
+
+    return(result);
+}
+
+// NOTE: 1/d falloff windowed by (1 - (d/r)^4)^2 so it's exactly 0 at the radius
+float PointLightAttenuation(float distance, float radius)
+{
+    float ratio = distance / radius;
+    float window = clamp(1.0f - ratio * ratio * ratio * ratio, 0.0f, 1.0f);
+    float result = (window * window) / distance;
+
+    return(result);
+}
+
+// NOTE: light_direction points from the fragment to the light
+vec3 CalculateLightContribution(vec3 light_direction, vec3 radiance, vec3 view, vec3 normal, vec3 albedo, float roughness, float metallic, vec3 F0)
+{
+    vec3 halfway = normalize(light_direction + view);
+    float cos_theta = clamp(dot(halfway, view), 0.0f, 1.0f);
+
+    float D = NormalDistributionGGX(normal, halfway, roughness);
+    float G = GeometrySmithShlick(normal, view, light_direction, roughness);
+    vec3 F = FresnelSchlick(cos_theta, F0);
+    vec3 numerator = D * F * G;
+    float n_dot_v = clamp(dot(normal, view), 0.0f, 1.0f);
+    float n_dot_l = clamp(dot(normal, light_direction), 0.0f, 1.0f);
+    float denominator = (4.0f * n_dot_v * n_dot_l) + 0.00001f;
+    vec3 specular = numerator / denominator;
+
+    vec3 k_specular = F;
+    vec3 k_diffuse = vec3(1.0f) - k_specular;
+    // NOTE: if the material is metallic, the diffuse is 0 since metals don't refract light
+    k_diffuse *= (1.0f - metallic);
+    vec3 result = ((k_diffuse * albedo / PI32) + specular) * radiance * n_dot_l;
+
+    return(result);
+}
+#endif
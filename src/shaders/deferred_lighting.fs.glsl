@@ -0,0 +1,82 @@
+#version 430 core
+
+// NOTE: lighting pass of the deferred mode, same lighting as pbr.fs.glsl but once per
+//       pixel from the g-buffer. CASCADE_COUNT and CLUSTER_GRID_X/Y/Z are injected when compiling
+#define COMMON_FRAME
+#define COMMON_LIGHTING
+#include "common.glsl"
+
+in vec2 tex_coords;
+
+// G-BUFFER, see rd_gbuffer.h
+layout (binding = 0) uniform sampler2D gbuffer_albedo_ao;
+layout (binding = 1) uniform sampler2D gbuffer_normal_material;
+layout (binding = 2) uniform sampler2D gbuffer_depth;
+uniform mat4 inverse_projection_mul_view;
+
+out vec4 frag_color;
+
+vec3 DecodeOctahedral(vec2 e)
+{
+    vec3 n = vec3(e, 1.0f - abs(e.x) - abs(e.y));
+    if(n.z < 0.0f)
+    {
+        n.xy = (1.0f - abs(n.yx)) * vec2(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+    }
+    vec3 result = normalize(n);
+
+    return(result);
+}
+
+void main()
+{
+    // NOTE: nothing was drawn here, the skybox fills it later
+    float depth = texture(gbuffer_depth, tex_coords).r;
+    if(depth == 1.0f)
+    {
+        discard;
+    }
+    vec4 clip_position = vec4(vec3(tex_coords, depth) * 2.0f - 1.0f, 1.0f);
+    vec4 world_position = inverse_projection_mul_view * clip_position;
+    vec3 fragment_position = world_position.xyz / world_position.w;
+
+    vec4 albedo_ao = texture(gbuffer_albedo_ao, tex_coords);
+    vec4 normal_material = texture(gbuffer_normal_material, tex_coords);
+    vec3 albedo = pow(albedo_ao.rgb, vec3(2.2f));
+    float AO = pow(albedo_ao.a, 2.2f);
+    vec3 normal = DecodeOctahedral(normal_material.xy * 2.0f - 1.0f);
+    float roughness = normal_material.z;
+    float metallic = normal_material.w;
+
+    vec3 view = normalize(viewer_position - fragment_position);
+
+    vec3 F0 = vec3(0.04f);
+    F0 = mix(F0, albedo, metallic);
+
+    vec3 Lo = vec3(0.0f);
+    uvec2 cluster = clusters[GetClusterIndex(fragment_position)];
+    for(uint i = cluster.x; i < cluster.x + cluster.y; i++)
+    {
+        point_light light = lights[light_indices[i]];
+        vec3 to_light = light.position_radius.xyz - fragment_position;
+        float distance = length(to_light);
+        if(distance >= light.position_radius.w)
+        {
+            continue;
+        }
+        vec3 radiance = light.color.rgb * PointLightAttenuation(distance, light.position_radius.w);
+        Lo += CalculateLightContribution(to_light / distance, radiance,
+                                         view, normal, albedo,
+                                         roughness, metallic, F0);
+    }
+
+    vec3 to_sun = sun_position - fragment_position;
+    float sun_distance = length(to_sun);
+    float shadow = 1.0f - CalculateShadow(fragment_position, normal);
+    Lo += CalculateLightContribution(to_sun / sun_distance, sun_color / sun_distance, view, normal, albedo,
+                                     roughness, metallic, F0) * shadow;
+    vec3 ambient = vec3(0.03f) * albedo * AO;
+    vec3 color = ambient + Lo;
+
+    frag_color = vec4(color, 1.0f);
+}
\ No newline at end of file
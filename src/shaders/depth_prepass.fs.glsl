@@ -0,0 +1,24 @@
+#version 430 core
+#if MATERIAL_BINDLESS
+#extension GL_ARB_bindless_texture : require
+#endif
+
+// NOTE: depth pre-pass, ALPHA_TEST is injected when compiling. Only materials with an
+//       alpha channel in their albedo map get the alpha test, the rest has an empty
+//       fragment shader so early-z stays on for them
+
+#if ALPHA_TEST
+#define COMMON_MATERIALS
+#include "common.glsl"
+#endif
+
+void main()
+{
+#if ALPHA_TEST
+    // NOTE: same test as the color pass shaders, that skip it when the pre-pass is on
+    if(SampleMaterialMap(ALBEDO_MAP, vertex_output.tex_coords).a < 0.69420f)
+    {
+        discard;
+    }
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,55 @@
+#version 430 core
+#if MATERIAL_BINDLESS
+#extension GL_ARB_bindless_texture : require
+#endif
+
+// NOTE: geometry pass of the deferred mode, only the surface is written here and
+//       pbr.fs.glsl's lighting runs once per pixel in deferred_lighting.fs.glsl.
+//       The layout of the targets is described in rd_gbuffer.h
+
+#define COMMON_MATERIALS
+#include "common.glsl"
+
+layout (location = 0) out vec4 albedo_ao;
+layout (location = 1) out vec4 normal_material;
+
+// NOTE: octahedral mapping of the unit sphere to [-1, 1]^2
+vec2 EncodeOctahedral(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 result = n.xy;
+    if(n.z < 0.0f)
+    {
+        result = (1.0f - abs(n.yx)) * vec2(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+    }
+
+    return(result);
+}
+
+void main()
+{
+    // NOTE, TODO: temporary, we don't handle translucent objects yet.
+    //             ALPHA_TEST is off when the depth pre-pass already did it
+    vec4 albedo = SampleMaterialMap(ALBEDO_MAP, vertex_output.tex_coords);
+#if ALPHA_TEST
+    if(albedo.a < 0.69420f)
+    {
+        discard;
+    }
+#endif
+
+    // NOTE: albedo and AO are stored as sampled, the lighting pass converts them to linear
+    vec3 normal = GetNormalFromMap();
+#if USE_METALLIC_ROUGHNESS
+    vec4 metallic_roughness = SampleMaterialMap(METALLIC_MAP, vertex_output.tex_coords);
+    float metallic = metallic_roughness.b;
+    float roughness = metallic_roughness.g;
+#else
+    float metallic = SampleMaterialMap(METALLIC_MAP, vertex_output.tex_coords).r;
+    float roughness = SampleMaterialMap(ROUGHNESS_MAP, vertex_output.tex_coords).r;
+#endif
+    float AO = SampleMaterialMap(AMBIENT_OCCLUSION_MAP, vertex_output.tex_coords).r;
+
+    albedo_ao = vec4(albedo.rgb, AO);
+    normal_material = vec4(EncodeOctahedral(normal) * 0.5f + 0.5f, roughness, metallic);
+}
\ No newline at end of file
@@ -1,8 +1,8 @@
-#version 420 core
+#version 430 core
 
 out vec4 frag_color;
 
-uniform vec3 light_color;
+flat in vec3 light_color;
 
 void main() 
 {
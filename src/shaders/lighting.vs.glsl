@@ -1,10 +1,19 @@
-#version 420 core
+#version 430 core
 
 layout (location = 0) in vec3 in_pos;
+// NOTE: x = light index, per instance from the draw list
+layout (location = 3) in uvec2 in_draw_instance;
 
-uniform mat4 model;
-uniform mat4 projection_mul_view;
+#define COMMON_FRAME
+#define COMMON_LIGHTS
+#include "common.glsl"
+
+flat out vec3 light_color;
+
+#define LIGHT_CUBE_SCALE 0.1f
 
 void main() {
-	gl_Position = projection_mul_view * model * vec4(in_pos, 1.0f);
+    point_light light = lights[in_draw_instance.x];
+    light_color = light.color.rgb;
+	gl_Position = projection_mul_view * vec4(light.position_radius.xyz + in_pos * LIGHT_CUBE_SCALE, 1.0f);
 }
\ No newline at end of file
@@ -7,8 +7,9 @@ in vec2 tex_coords;
 uniform sampler2D screen_texture;
 uniform sampler2D bloom_texture;
 uniform float exposure;
-uniform int bloom_enabled;
-uniform int tonemapper_choice;
+
+// NOTE: BLOOM_ENABLED and TONEMAPPER are injected when compiling, one program per
+//       combination. TONEMAPPER: 0 = none, 1 = exponential, 2 = ACES
 
 // NOTE: tonemapping code taken from https://github.com/TheRealMJP/BakingLab/blob/master/BakingLab/ACES.hlsl
 mat3x3 ACESInputMat = mat3x3
@@ -42,22 +43,18 @@ void main()
 {
     vec3 color = texture(screen_texture, tex_coords).rgb;
 
-    if(bloom_enabled > 0)
-    {
-        vec3 bloom_sample = texture(bloom_texture, tex_coords).rgb;
-        color = mix(color, bloom_sample, 0.04f);
-    }
+#if BLOOM_ENABLED
+    vec3 bloom_sample = texture(bloom_texture, tex_coords).rgb;
+    color = mix(color, bloom_sample, 0.04f);
+#endif
 
     // NOTE: tonemapping then gamma correct
     color = color * exposure;
-    if(tonemapper_choice == 1)
-    {
-        color = vec3(1.0f) - exp(-color);
-    }
-    else if(tonemapper_choice == 2)
-    {
-        color = ACESFitted(color);
-    }
+#if TONEMAPPER == 1
+    color = vec3(1.0f) - exp(-color);
+#elif TONEMAPPER == 2
+    color = ACESFitted(color);
+#endif
     color = pow(color, vec3(1.0f / 2.2f));
     frag_color = vec4(color, 1.0f);
 }
\ No newline at end of file
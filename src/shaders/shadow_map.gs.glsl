@@ -1,8 +1,6 @@
 #version 420 core
 
-#define CASCADE_COUNT 3
-
-layout (triangles, invocations = 5) in;
+layout (triangles, invocations = CASCADE_COUNT) in;
 layout (triangle_strip, max_vertices = 3) out;
 
 layout (std140, binding = 0) uniform light_space_matrices_ubo
@@ -10,8 +8,16 @@ layout (std140, binding = 0) uniform light_space_matrices_ubo
     mat4 light_space_matrices[CASCADE_COUNT];
 };
 
+// NOTE: bit i set if the mesh overlaps cascade i, set by RenderShadowCasterList
+flat in uint cascade_mask[];
+
 void main()
 {
+    if((cascade_mask[0] & (1u << gl_InvocationID)) == 0u)
+    {
+        return;
+    }
+
     for(int i = 0; i < 3; i++)
     {
         gl_Position = light_space_matrices[gl_InvocationID] * gl_in[i].gl_Position;
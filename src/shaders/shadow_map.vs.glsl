@@ -1,10 +1,24 @@
-#version 420 core
+#version 430 core
 
 layout (location = 0) in vec3 in_pos;
+// NOTE: x = object index, y = cascade mask, per instance from the draw list
+layout (location = 3) in uvec2 in_draw_instance;
 
-uniform mat4 model;
+struct object_data
+{
+    mat4 model;
+    mat3 normal_matrix;
+};
+
+layout (std430, row_major, binding = 0) readonly buffer object_buffer
+{
+    object_data objects[];
+};
+
+flat out uint cascade_mask;
 
 void main()
 {
-    gl_Position = model * vec4(in_pos, 1.0f);
+    gl_Position = objects[in_draw_instance.x].model * vec4(in_pos, 1.0f);
+    cascade_mask = in_draw_instance.y;
 }
\ No newline at end of file
@@ -0,0 +1,36 @@
+#version 430 core
+#extension GL_ARB_shader_viewport_layer_array : enable
+#extension GL_AMD_vertex_shader_layer : enable
+
+// NOTE: alternative to shadow_map.gs.glsl, every mesh is drawn with one instance
+//       per cascade it overlaps and the layer is picked here, no geometry shader
+
+layout (location = 0) in vec3 in_pos;
+// NOTE: x = object index, y = cascade mask, per instance from the draw list.
+//       every instance has a single cascade in the mask, the node gets one
+//       instance per cascade it overlaps
+layout (location = 3) in uvec2 in_draw_instance;
+
+struct object_data
+{
+    mat4 model;
+    mat3 normal_matrix;
+};
+
+layout (std430, row_major, binding = 0) readonly buffer object_buffer
+{
+    object_data objects[];
+};
+
+layout (std140, binding = 0) uniform light_space_matrices_ubo
+{
+    mat4 light_space_matrices[CASCADE_COUNT];
+};
+
+void main()
+{
+    int layer = findLSB(in_draw_instance.y);
+
+    gl_Position = light_space_matrices[layer] * objects[in_draw_instance.x].model * vec4(in_pos, 1.0f);
+    gl_Layer = layer;
+}
\ No newline at end of file
@@ -1,8 +1,10 @@
-#version 420 core
+#version 430 core
 
 layout (location = 0) in vec3 in_pos;
 layout (location = 1) in vec3 in_normal;
 layout (location = 2) in vec2 in_tex_coords;
+// NOTE: x = object index, y = material index, per instance from the draw list
+layout (location = 3) in uvec2 in_draw_instance;
 
 out vs_out
 {
@@ -10,16 +12,31 @@ out vs_out
     vec3 normal;
     vec2 tex_coords;
 } vertex_output;
+flat out uint material_index;
+// NOTE: the depth pre-pass and the color pass must compute the exact same depth for GL_EQUAL
+invariant gl_Position;
 
-uniform mat4 model;
-uniform mat4 projection_mul_view;
-uniform mat3 normal_matrix;
+#define COMMON_FRAME
+#include "common.glsl"
+
+struct object_data
+{
+    mat4 model;
+    mat3 normal_matrix;
+};
+
+layout (std430, row_major, binding = 0) readonly buffer object_buffer
+{
+    object_data objects[];
+};
 
 void main()
 {
-    vec4 world_position = model * vec4(in_pos, 1.0f);
+    object_data object = objects[in_draw_instance.x];
+    vec4 world_position = object.model * vec4(in_pos, 1.0f);
     vertex_output.fragment_position = world_position.xyz;
-    vertex_output.normal = normal_matrix * in_normal;
+    vertex_output.normal = object.normal_matrix * in_normal;
+    material_index = in_draw_instance.y;
     vertex_output.tex_coords = in_tex_coords;
     
     gl_Position = projection_mul_view * world_position;
@@ -0,0 +1,419 @@
+// NOTE: offline texture compressor, writes <image>.rdtex next to every image with the
+//       whole mip chain block compressed. LoadTexture uses the container as long as the
+//       image hasn't changed since. Doesn't need a GL context, -verify decodes the written
+//       file back on the cpu and reports the error of every mip level.
+//       The format comes from the role of the texture: -model reads the material slots
+//       of a model the same way the runtime does, -role sets it for the images after it
+
+#include "../rd_lib.h"
+#include "../rd_texture_compression.h"
+#include "../thirdparty/stb/stb_image.h"
+
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+// NOTE: the slot of pbr_texture_group the texture is used in
+enum texture_role
+{
+    TextureRole_None,
+    TextureRole_Albedo,
+    TextureRole_Normal,
+    TextureRole_Metallic,
+    TextureRole_Roughness,
+    TextureRole_AO,
+    // NOTE: the gltf map that is both, roughness in g and metalness in b
+    TextureRole_MetallicRoughness,
+};
+
+struct compressor_options
+{
+    u32 format;
+    b32 verify;
+};
+
+INTERNAL void PrintUsage(void)
+{
+    printf("usage: texture_compressor [-format bc1|bc3|bc4|bc5] [-verify] [-model model]...\n"
+           "                          [-role albedo|normal|metallic|roughness|ao|metallic_roughness] [image]...\n"
+           "  -model compresses every texture of the model with the role of its material slot,\n"
+           "  -role applies to the images after it\n"
+           "  without -format: normal -> bc5, metallic, roughness and ao -> bc4,\n"
+           "  albedo with alpha -> bc3, albedo and metallic_roughness -> bc1\n"
+           "  images without a role: 1 channel -> bc4, with alpha -> bc3, everything else -> bc1\n");
+}
+
+INTERNAL u32 ParseRole(const char *name)
+{
+    LOCAL const char *name_list[] = {"none", "albedo", "normal", "metallic", "roughness", "ao", "metallic_roughness"};
+    u32 result = TextureRole_None;
+    for(u32 role = 1; role < ArrayCount(name_list); role++)
+    {
+        if(strcmp(name, name_list[role]) == 0)
+        {
+            result = role;
+        }
+    }
+
+    return(result);
+}
+
+INTERNAL u32 ParseFormat(const char *name)
+{
+    u32 result = TextureBlockFormat_None;
+    if(strcmp(name, "bc1") == 0)
+    {
+        result = TextureBlockFormat_BC1;
+    }
+    else if(strcmp(name, "bc3") == 0)
+    {
+        result = TextureBlockFormat_BC3;
+    }
+    else if(strcmp(name, "bc4") == 0)
+    {
+        result = TextureBlockFormat_BC4;
+    }
+    else if(strcmp(name, "bc5") == 0)
+    {
+        result = TextureBlockFormat_BC5;
+    }
+
+    return(result);
+}
+
+INTERNAL const char *GetFormatName(u32 format)
+{
+    LOCAL const char *name_list[] = {"none", "bc1", "bc3", "bc4", "bc5"};
+    const char *result = (format < ArrayCount(name_list)) ? name_list[format] : "unknown";
+
+    return(result);
+}
+
+INTERNAL u32 GetFormatChannelCount(u32 format)
+{
+    LOCAL const u32 channel_count_list[] = {0, 3, 4, 1, 2};
+    u32 result = channel_count_list[format];
+
+    return(result);
+}
+
+// NOTE: same slots as GetMaterialTexturePaths, a map that is in both the metallic and
+//       the roughness slot is a gltf metallic-roughness map
+INTERNAL void AddMaterialTextureRole(std::unordered_map<std::string, u32> &role_table, aiMaterial *mat,
+                                     std::string &directory, aiTextureType type, aiTextureType fallback_type, u32 role)
+{
+    aiString filename;
+    if(mat->GetTextureCount(type) > 0)
+    {
+        mat->GetTexture(type, 0, &filename);
+    }
+    else if(mat->GetTextureCount(fallback_type) > 0)
+    {
+        mat->GetTexture(fallback_type, 0, &filename);
+    }
+    else
+    {
+        return;
+    }
+
+    std::string path = directory + '/' + filename.C_Str();
+    auto found = role_table.find(path);
+    if(found == role_table.end())
+    {
+        role_table.insert({path, role});
+    }
+    else if(((found->second == TextureRole_Metallic) && (role == TextureRole_Roughness)) ||
+            ((found->second == TextureRole_Roughness) && (role == TextureRole_Metallic)))
+    {
+        found->second = TextureRole_MetallicRoughness;
+    }
+}
+
+INTERNAL b32 AddModelTextureRoles(std::unordered_map<std::string, u32> &role_table, const char *model_path)
+{
+    // NOTE: only the materials are needed, no post processing
+    Assimp::Importer import;
+    const aiScene *scene = import.ReadFile(model_path, 0);
+    if(!scene)
+    {
+        printf("%s: can't load model: %s\n", model_path, import.GetErrorString());
+        return(false);
+    }
+
+    std::string path = model_path;
+    std::string directory = path.substr(0, path.find_last_of('/'));
+    for(u32 material_index = 0; material_index < scene->mNumMaterials; material_index++)
+    {
+        aiMaterial *mat = scene->mMaterials[material_index];
+        AddMaterialTextureRole(role_table, mat, directory, aiTextureType_DIFFUSE, aiTextureType_BASE_COLOR,
+                               TextureRole_Albedo);
+        AddMaterialTextureRole(role_table, mat, directory, aiTextureType_NORMALS, aiTextureType_HEIGHT,
+                               TextureRole_Normal);
+        AddMaterialTextureRole(role_table, mat, directory, aiTextureType_METALNESS, aiTextureType_METALNESS,
+                               TextureRole_Metallic);
+        AddMaterialTextureRole(role_table, mat, directory, aiTextureType_DIFFUSE_ROUGHNESS,
+                               aiTextureType_DIFFUSE_ROUGHNESS, TextureRole_Roughness);
+        AddMaterialTextureRole(role_table, mat, directory, aiTextureType_AMBIENT_OCCLUSION, aiTextureType_AMBIENT,
+                               TextureRole_AO);
+    }
+
+    return(true);
+}
+
+// NOTE: the metallic-roughness map stays in bc1, the shader reads roughness from g and
+//       metalness from b and bc5 only keeps r and g. Bc1 has 6 bits for g and 5 for b
+INTERNAL u32 ChooseFormat(u8 *image, u32 width, u32 height, i32 channel_count, u32 role)
+{
+    if(role == TextureRole_Normal)
+    {
+        return(TextureBlockFormat_BC5);
+    }
+    if((role == TextureRole_Metallic) || (role == TextureRole_Roughness) || (role == TextureRole_AO) ||
+       ((role == TextureRole_None) && (channel_count == 1)))
+    {
+        return(TextureBlockFormat_BC4);
+    }
+    if(role == TextureRole_MetallicRoughness)
+    {
+        return(TextureBlockFormat_BC1);
+    }
+    for(u64 i = 0; i < (u64)width * height; i++)
+    {
+        if(image[i * 4 + 3] != 255)
+        {
+            return(TextureBlockFormat_BC3);
+        }
+    }
+
+    return(TextureBlockFormat_BC1);
+}
+
+// NOTE: peak signal to noise ratio over the channels the format keeps
+INTERNAL f64 ComputePSNR(u8 *a, u8 *b, u32 width, u32 height, u32 channel_count)
+{
+    f64 squared_error = 0.0;
+    for(u64 i = 0; i < (u64)width * height; i++)
+    {
+        for(u32 channel = 0; channel < channel_count; channel++)
+        {
+            f64 d = (f64)a[i * 4 + channel] - (f64)b[i * 4 + channel];
+            squared_error += d * d;
+        }
+    }
+    f64 mse = squared_error / ((f64)width * height * channel_count);
+    f64 result = (mse > 0.0) ? 10.0 * log10(255.0 * 255.0 / mse) : 99.0;
+
+    return(result);
+}
+
+// NOTE: same temp file + rename as the mesh cache so a crash never leaves a broken container
+INTERNAL b32 WriteTextureContainer(std::string &path, texture_container_header *header,
+                                   std::vector<std::vector<u8>> &mip_list)
+{
+    std::string temp_path = path + ".tmp";
+    FILE *file = fopen(temp_path.c_str(), "wb");
+    if(!file)
+    {
+        return(false);
+    }
+    fwrite(header, sizeof(*header), 1, file);
+    for(std::vector<u8> &mip : mip_list)
+    {
+        fwrite(&mip[0], 1, mip.size(), file);
+    }
+    b32 result = (ferror(file) == 0);
+    fclose(file);
+
+    if(result)
+    {
+        result = (rename(temp_path.c_str(), path.c_str()) == 0);
+    }
+    else
+    {
+        remove(temp_path.c_str());
+    }
+
+    return(result);
+}
+
+INTERNAL b32 VerifyTextureContainer(std::string &path, const char *source_path,
+                                    std::vector<std::vector<u8>> &image_list)
+{
+    u64 size;
+    u8 *container = ReadTextureContainer(path.c_str(), source_path, &size);
+    if(!container)
+    {
+        printf("  verify: %s can't be read back\n", path.c_str());
+        return(false);
+    }
+
+    texture_container_header *header = (texture_container_header *)container;
+    u32 channel_count = GetFormatChannelCount(header->format);
+    for(u32 level = 0; level < header->mip_count; level++)
+    {
+        u32 width = GetMipDimension(header->width, level);
+        u32 height = GetMipDimension(header->height, level);
+        std::vector<u8> decoded((u64)width * height * 4);
+        DecompressImage(container + header->mip_offset[level], width, height, header->format, &decoded[0]);
+        printf("  mip %2u %5ux%-5u psnr %6.2f dB\n", level, width, height,
+               ComputePSNR(&image_list[level][0], &decoded[0], width, height, channel_count));
+    }
+    free(container);
+
+    return(true);
+}
+
+INTERNAL b32 CompressTexture(const char *source_path, u32 role, compressor_options *options)
+{
+    i32 width, height, channel_count;
+    u8 *image = stbi_load(source_path, &width, &height, &channel_count, 4);
+    if(!image)
+    {
+        printf("%s: can't load image\n", source_path);
+        return(false);
+    }
+
+    b32 is_normal_map = (role == TextureRole_Normal);
+    u32 format = options->format;
+    if(format == TextureBlockFormat_None)
+    {
+        format = ChooseFormat(image, width, height, channel_count, role);
+    }
+
+    texture_container_header header = {};
+    header.magic = TEXTURE_CONTAINER_MAGIC;
+    header.version = TEXTURE_CONTAINER_VERSION;
+    header.format = format;
+    header.width = width;
+    header.height = height;
+    header.mip_count = GetMipCount(width, height);
+    GetFileInfo(source_path, &header.source_size, &header.source_mtime);
+
+    std::vector<std::vector<u8>> image_list(header.mip_count);
+    std::vector<std::vector<u8>> mip_list(header.mip_count);
+    image_list[0].assign(image, image + (u64)width * height * 4);
+    stbi_image_free(image);
+
+    u64 offset = sizeof(header);
+    for(u32 level = 0; level < header.mip_count; level++)
+    {
+        u32 mip_width = GetMipDimension(header.width, level);
+        u32 mip_height = GetMipDimension(header.height, level);
+        if(level > 0)
+        {
+            image_list[level].resize((u64)mip_width * mip_height * 4);
+            DownsampleImage(&image_list[level - 1][0], GetMipDimension(header.width, level - 1),
+                            GetMipDimension(header.height, level - 1), &image_list[level][0], is_normal_map);
+        }
+        mip_list[level].resize(GetCompressedMipSize(format, mip_width, mip_height));
+        CompressImage(&image_list[level][0], mip_width, mip_height, format, &mip_list[level][0]);
+        header.mip_offset[level] = offset;
+        header.mip_size[level] = mip_list[level].size();
+        offset += mip_list[level].size();
+    }
+
+    std::string container_path = std::string(source_path) + TEXTURE_CONTAINER_EXTENSION;
+    if(!WriteTextureContainer(container_path, &header, mip_list))
+    {
+        printf("%s: can't write %s\n", source_path, container_path.c_str());
+        return(false);
+    }
+
+    u64 uncompressed_size = (u64)width * height * channel_count * 4 / 3;
+    printf("%s: %dx%d %s, %u mips, %llu KB -> %llu KB\n", source_path, width, height, GetFormatName(format),
+           header.mip_count, uncompressed_size / 1024, offset / 1024);
+
+    b32 result = true;
+    if(options->verify)
+    {
+        result = VerifyTextureContainer(container_path, source_path, image_list);
+    }
+
+    return(result);
+}
+
+int main(int argument_count, char **argument_list)
+{
+    compressor_options options = {};
+    // NOTE: images by path, an image used by a model and also given on its own
+    //       keeps the role of its material slot
+    std::vector<std::string> path_list;
+    std::unordered_map<std::string, u32> role_table;
+    u32 role = TextureRole_None;
+    u32 failed_count = 0;
+    for(i32 i = 1; i < argument_count; i++)
+    {
+        const char *argument = argument_list[i];
+        if((strcmp(argument, "-format") == 0) && (i + 1 < argument_count))
+        {
+            options.format = ParseFormat(argument_list[++i]);
+            if(options.format == TextureBlockFormat_None)
+            {
+                PrintUsage();
+                return(1);
+            }
+        }
+        else if((strcmp(argument, "-role") == 0) && (i + 1 < argument_count))
+        {
+            role = ParseRole(argument_list[++i]);
+            if(role == TextureRole_None)
+            {
+                PrintUsage();
+                return(1);
+            }
+        }
+        else if((strcmp(argument, "-model") == 0) && (i + 1 < argument_count))
+        {
+            std::unordered_map<std::string, u32> model_role_table;
+            if(!AddModelTextureRoles(model_role_table, argument_list[++i]))
+            {
+                failed_count++;
+            }
+            for(auto &entry : model_role_table)
+            {
+                auto inserted = role_table.insert(entry);
+                if(inserted.second)
+                {
+                    path_list.push_back(entry.first);
+                }
+                else if(inserted.first->second == TextureRole_None)
+                {
+                    inserted.first->second = entry.second;
+                }
+            }
+        }
+        else if(strcmp(argument, "-verify") == 0)
+        {
+            options.verify = true;
+        }
+        else if(argument[0] == '-')
+        {
+            PrintUsage();
+            return(1);
+        }
+        else if(role_table.insert({argument, role}).second)
+        {
+            path_list.push_back(argument);
+        }
+    }
+    if(path_list.empty())
+    {
+        PrintUsage();
+        return(1);
+    }
+
+    // NOTE: the runtime loads images flipped, the blocks are stored the same way
+    stbi_set_flip_vertically_on_load(true);
+    for(std::string &path : path_list)
+    {
+        if(!CompressTexture(path.c_str(), role_table[path], &options))
+        {
+            failed_count++;
+        }
+    }
+
+    return(failed_count ? 1 : 0);
+}